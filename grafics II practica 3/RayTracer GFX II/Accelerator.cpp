@@ -0,0 +1,33 @@
+#include <string.h>
+
+#include "Accelerator.h"
+#include "BVH.h"
+#include "WideBVH.h"
+#include "CompressedBVH.h"
+#include "Grid.h"
+#include "LazyBVH.h"
+
+static const double RebuildRatio = 1.5;	// Growth of the SAH cost that makes Update rebuild
+
+Accelerator *Accelerator::Create( const char *name )
+{
+	if( strcmp( name, "bvh"  ) == 0 ) return new BVH( BVH_BINNED );
+	if( strcmp( name, "sbvh" ) == 0 ) return new BVH( BVH_SPATIAL );
+	if( strcmp( name, "bvh4" ) == 0 ) return new QBVH();
+	if( strcmp( name, "bvh8" ) == 0 ) return new OBVH();
+	if( strcmp( name, "cbvh" ) == 0 ) return new CompressedBVH();
+	if( strcmp( name, "grid" ) == 0 ) return new Grid( false );
+	if( strcmp( name, "grid2" ) == 0 ) return new Grid( true );
+	if( strcmp( name, "lazybvh" ) == 0 ) return new LazyBVH();
+	return NULL;
+}
+
+
+bool Accelerator::Update( Object *first )
+{
+	Refit();
+	if( Cost() <= RebuildRatio * build_cost ) return false;
+
+	Build( first );
+	return true;
+}
\ No newline at end of file
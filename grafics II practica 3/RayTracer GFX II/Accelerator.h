@@ -0,0 +1,129 @@
+#ifndef ACCELERATOR_H
+#define ACCELERATOR_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines the interface shared by all the structures that speed  *
+* up ray queries.  An accelerator is built once over the linked list of    *
+* objects of the scene and then answers the questions the brute force      *
+* loop used to: which is the closest object hit by a ray, and whether      *
+* anything blocks a shadow ray.  The one used is chosen by name, from the  *
+* "accelerator" line of the scene file or from the command line, so they   *
+* can be compared on the same scene.                                       *
+*                                                                          *
+* When objects move, Update refits the structure to their new bounds       *
+* instead of building it again.  Refitting keeps the tree, so it grows     *
+* looser as the objects drift away from where they were when it was built; *
+* its SAH cost is compared with the one it had after the build, and the    *
+* structure is rebuilt once it has grown too much.                         *
+*                                                                          *
+* Structures can also be saved to a cache file and loaded back on a later  *
+* run over the same objects, skipping the build (see Cache.h).             *
+*                                                                          *
+* The queries count the nodes they visit and the objects they test in      *
+* query_counters, for the statistics of a render (see Stats.h).            *
+*                                                                          *
+***************************************************************************/
+
+#include <iostream>
+
+#include "Object.h"
+#include "Stats.h"
+
+using namespace std;
+
+// Costs of the surface area heuristic, shared by every structure so that
+// their Cost() can be compared with each other and with the rebuild
+// threshold of Update.
+static const double TraversalCost = 0.125;	// Cost of visiting a node or a cell, relative to one Object::Intersect
+static const double IntersectCost = 1.0;	// Cost of intersecting one object
+
+enum Traversal // How a query walks a hierarchy.
+{
+	TRAVERSAL_STACK,		// Keeping a stack of the nodes left to visit.
+	TRAVERSAL_STACKLESS		// Moving through parent and sibling links, without a stack.
+};
+
+class Accelerator
+{
+	public:
+		double build_time;	// Seconds spent in the last call to Build.
+		double build_cost;	// SAH cost right after the last call to Build, as Refit would leave it.
+		double refit_time;	// Seconds spent in the last call to Refit.
+
+		Accelerator() { build_time = build_cost = refit_time = 0.0; }
+		virtual ~Accelerator() {}
+
+		// Builds the structure over the linked list of objects that starts
+		// at "first", using the bounds reported by Object::GetBounds.
+		virtual void Build( Object *first ) = 0;
+
+		// Finds the closest object hit by the ray that is nearer than
+		// hitgeom.distance, skipping "ignore".  Returns the object hit (as
+		// reported by Object::Hit), or NULL if there is none, and leaves in
+		// "hitgeom" what Hit records of it: the caller gets the point and
+		// normal from hitgeom.object->GetHitAttributes.
+		virtual const Object *Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore = NULL ) const = 0;
+
+		// Returns true as soon as any object other than "ignore" is found
+		// closer than max_distance along the ray.  Used for shadow rays, it
+		// does not look for the closest hit nor write any hit information.
+		virtual bool Occluded( const Ray &ray, double max_distance, const Object *ignore = NULL ) const = 0;
+
+		// The same queries, walking the structure without a stack of nodes
+		// still to visit, so that a ray carries only a few words of state
+		// while it is traced.  Structures without such a walk, or whose walk
+		// needs no stack already, answer them as Intersect and Occluded do.
+		virtual const Object *IntersectStackless( const Ray &ray, HitGeom &hitgeom, const Object *ignore = NULL ) const { return Intersect( ray, hitgeom, ignore ); }
+		virtual bool OccludedStackless( const Ray &ray, double max_distance, const Object *ignore = NULL ) const { return Occluded( ray, max_distance, ignore ); }
+
+		// Runs Intersect or Occluded with the given traversal.
+		const Object *Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore, Traversal traversal ) const
+		{
+			return traversal == TRAVERSAL_STACKLESS ? IntersectStackless( ray, hitgeom, ignore ) : Intersect( ray, hitgeom, ignore );
+		}
+		bool Occluded( const Ray &ray, double max_distance, const Object *ignore, Traversal traversal ) const
+		{
+			return traversal == TRAVERSAL_STACKLESS ? OccludedStackless( ray, max_distance, ignore ) : Occluded( ray, max_distance, ignore );
+		}
+
+		// Recomputes the bounds stored in the structure, bottom-up, after
+		// the objects it was built over have moved.  The objects must be the
+		// same ones; only their bounds may change.
+		virtual void Refit() = 0;
+
+		// Cost of tracing rays through the structure by the surface area
+		// heuristic, measured relative to the objects themselves so that it
+		// only grows when the boxes of the structure become loose.
+		virtual double Cost() const = 0;
+
+		// Refits the structure, and builds it again from the list of objects
+		// if the refit has made its cost grow too much since the last build.
+		// Returns true if it was rebuilt.
+		bool Update( Object *first );
+
+		// Write the built structure to a cache file, or load it back for the
+		// objects of the list that starts at "first".  "key" identifies those
+		// objects, see SceneHash.  Both return false when the file cannot be
+		// written or does not match.  Structures that are not worth caching
+		// return false from Cacheable and need not implement them.
+		virtual bool Cacheable() const { return false; }
+		virtual bool Save( const char *file_name, unsigned long long key, Object *first ) const { return false; }
+		virtual bool Load( const char *file_name, unsigned long long key, Object *first ) { return false; }
+
+		// Short name of the accelerator, as accepted by Create.
+		virtual const char *Name() const = 0;
+
+		// Prints the build time and the size of the structure.
+		virtual void Report( ostream &out ) const = 0;
+
+		// Adds every leaf of the structure, with its depth, to "stats".
+		virtual void GetTreeStats( TreeStats &stats ) const = 0;
+
+		// Returns a new, unbuilt accelerator given its name ("bvh", "sbvh",
+		// "bvh4", "bvh8", "cbvh", "grid", "grid2" or "lazybvh"), or NULL if
+		// the name is unknown.
+		static Accelerator *Create( const char *name );
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include "windows.h"
+#include <stdlib.h>
+#include <string.h>
+#include <string>
 #include "AppMain.h"
 
 void Keyboard(unsigned char tecla, int x, int y)
@@ -28,6 +31,25 @@ void Idle( void )
 	}
 }
 
+// Compares the image and render time just written to Resultat.ppm and
+// Resultat.json with those of a reference render, saved as
+// <reference>.ppm and <reference>.json, usually by the other precision.
+void CompareWithReference( const char *reference )
+{
+	Image image( RESOLUTIONX, RESOLUTIONY ), other( RESOLUTIONX, RESOLUTIONY );
+	double seconds, other_seconds;
+	string name( reference );
+
+	if (!image.Read( "Resultat.ppm" ) || !ReadRenderSeconds( "Resultat.json", seconds ) ||
+		!other.Read( ( name + ".ppm" ).c_str() ) || !ReadRenderSeconds( ( name + ".json" ).c_str(), other_seconds ))
+	{
+		cerr << "Could not read the render or the reference " << reference << endl;
+		return;
+	}
+	cout << "Speedup over " << reference << ": " << other_seconds / seconds << " (" << seconds << " s against "
+		 << other_seconds << " s), image RMSE " << image.RMSE( other ) << " of 255." << endl;
+}
+
 void main(int argc, char** argv)
 {
 	glutInit(&argc, argv);
@@ -38,8 +60,67 @@ void main(int argc, char** argv)
 
 	glClearColor (0.0, 0.0, 0.0, 0.0);
 
-	if ( w.readScene("escena.sdf") )
+	// Optional arguments: the scene file, "-accel <name>" to choose the
+	// accelerator used to cast rays (bvh, sbvh, bvh4, bvh8, cbvh, grid, grid2 or lazybvh),
+	// "-nocache" to always build it instead of using the cache file next to the scene, "-trikernel <name>"
+	// to choose the ray-triangle test (barycentric, moller or watertight), "-benchlayout" or
+	// "-benchtriangles" to compare the memory layouts of the BVH or the triangle tests on the scene and quit,
+	// "-benchanimate <frames>" to move the spheres and cubes of the scene for that many frames, refitting the
+	// accelerator after each one and rebuilding it when it gets too loose, and quit,
+	// "-render" to render the image without showing it and quit, and "-compare <reference>" to do the same and
+	// then compare it with <reference>.ppm and <reference>.json (see ComparePrecision.bat)
+	const char *scene_file = "escena.sdf";
+	const char *accel = NULL;
+	const char *reference = NULL;
+	bool use_cache = true;
+	bool bench_layout = false;
+	bool bench_triangles = false;
+	int animate_frames = 0;
+	bool render_only = false;
+	for (int i = 1; i < argc; i++)
 	{
+		if (strcmp(argv[i], "-accel") == 0 && i + 1 < argc) accel = argv[++i];
+		else if (strcmp(argv[i], "-nocache") == 0) use_cache = false;
+		else if (strcmp(argv[i], "-benchlayout") == 0) bench_layout = true;
+		else if (strcmp(argv[i], "-benchtriangles") == 0) bench_triangles = true;
+		else if (strcmp(argv[i], "-benchanimate") == 0 && i + 1 < argc) animate_frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-render") == 0) render_only = true;
+		else if (strcmp(argv[i], "-compare") == 0 && i + 1 < argc)
+		{
+			reference = argv[++i];
+			render_only = true;
+		}
+		else if (strcmp(argv[i], "-trikernel") == 0 && i + 1 < argc)
+		{
+			if (!Triangle::KernelByName(argv[++i], Triangle::kernel)) cout << "Unknown triangle kernel " << argv[i] << endl;
+		}
+		else scene_file = argv[i];
+	}
+
+	if ( w.readScene(scene_file, accel, use_cache) )
+	{
+		if (bench_layout)
+		{
+			w.benchmarkLayouts( RESOLUTIONX , RESOLUTIONY );
+			return;
+		}
+		if (bench_triangles)
+		{
+			w.benchmarkTriangles( 4000000 );
+			return;
+		}
+		if (animate_frames > 0)
+		{
+			w.benchmarkAnimation( animate_frames );
+			return;
+		}
+		if (render_only)
+		{
+			while (!g_raytracer.IsDone()) g_raytracer.cast_line( w );
+			if (reference != NULL) CompareWithReference( reference );
+			return;
+		}
+
 		glutKeyboardFunc( Keyboard );
 		glutIdleFunc( Idle );
 		glutDisplayFunc( Draw );	
@@ -0,0 +1,1060 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "BVH.h"
+#include "Cache.h"
+
+static const int    MaxLeafSize   = 4;		// Nodes with more objects than this are always split
+static const int    MaxDepth      = 60;		// Keeps the traversal stack bounded on degenerate inputs
+static const int    StackSize     = 64;
+static const int    NumBins       = 16;		// Candidate split planes per axis in the binned builder
+static const int    ParallelSize  = 4096;	// Smallest subtree worth handing to another thread
+static const double MaxDuplication = 0.5;	// Extra references the spatial builder may add, per object
+static const double SpatialOverlap = 1.0E-5;	// Overlap of an object split, relative to the root area, that makes a spatial split worth trying
+
+// Orders build records by the center of their box along one axis.
+class CenterLess
+{
+	public:
+		int axis;
+		CenterLess( int a ) { axis = a; }
+		bool operator()( const BVHPrim &a, const BVHPrim &b ) const
+		{
+			return Component( a.center, axis ) < Component( b.center, axis );
+		}
+};
+
+int ObjectSplit::Bin( const BVHPrim &prim ) const
+{
+	int b = (int)( ( Component( prim.center, axis ) - lo ) * scale );
+	return b < NumBins ? b : NumBins - 1;
+}
+
+// Drops the centers of prims[begin, end), whose bounds are "box", into
+// NumBins bins per axis and evaluates the SAH cost of splitting at each bin
+// boundary.
+ObjectSplit FindObjectSplit( const std::vector<BVHPrim> &prims, int begin, int end, const Box3 &box )
+{
+	ObjectSplit best;
+	Box3 centers = EmptyBox();
+
+	best.cost = Infinity;
+	best.axis = -1;
+	best.bin  = 0;
+	best.lo = best.scale = 0.0;
+
+	for( int i = begin; i < end; i++ )
+	{
+		Box3 c;
+		c.X.min = c.X.max = prims[i].center.x;
+		c.Y.min = c.Y.max = prims[i].center.y;
+		c.Z.min = c.Z.max = prims[i].center.z;
+		centers = Union( centers, c );
+	}
+
+	double area = SurfaceArea( box );
+	double lo[3] = { centers.X.min, centers.Y.min, centers.Z.min };
+	double hi[3] = { centers.X.max, centers.Y.max, centers.Z.max };
+
+	for( int axis = 0; axis < 3; axis++ )
+	{
+		Box3 bin_box[NumBins];
+		int  bin_count[NumBins];
+		Box3 right_box[NumBins];
+		int  right_count[NumBins];
+
+		// All the centers on the same plane, nothing to split along this axis.
+		if( hi[axis] <= lo[axis] ) continue;
+		double scale = NumBins / ( hi[axis] - lo[axis] );
+
+		for( int b = 0; b < NumBins; b++ ) { bin_box[b] = EmptyBox(); bin_count[b] = 0; }
+		for( int i = begin; i < end; i++ )
+		{
+			int b = (int)( ( Component( prims[i].center, axis ) - lo[axis] ) * scale );
+			if( b >= NumBins ) b = NumBins - 1;
+			bin_box[b] = Union( bin_box[b], prims[i].box );
+			bin_count[b]++;
+		}
+
+		// Bounds and number of objects right of each bin boundary.
+		Box3 right = EmptyBox();
+		int  n = 0;
+		for( int b = NumBins - 1; b > 0; b-- )
+		{
+			right = Union( right, bin_box[b] );
+			n += bin_count[b];
+			right_box[b]   = right;
+			right_count[b] = n;
+		}
+
+		Box3 left = EmptyBox();
+		n = 0;
+		for( int b = 1; b < NumBins; b++ )
+		{
+			left = Union( left, bin_box[b - 1] );
+			n += bin_count[b - 1];
+			if( n == 0 || right_count[b] == 0 ) continue;
+			double cost = TraversalCost + IntersectCost *
+				( SurfaceArea( left ) * n + SurfaceArea( right_box[b] ) * right_count[b] ) / ( area > 0.0 ? area : 1.0 );
+			if( cost < best.cost )
+			{
+				best.cost  = cost;
+				best.axis  = axis;
+				best.bin   = b;
+				best.lo    = lo[axis];
+				best.scale = scale;
+				best.left  = left;
+				best.right = right_box[b];
+			}
+		}
+	}
+	return best;
+}
+
+// Binned SAH builder.  Builds the subtree for prims[begin, end) at the end
+// of "out" and returns the index of its root.  Indices of second children
+// are relative to "out", which lets a subtree be built in a separate array
+// by another thread and appended afterwards.
+static int BuildBinned( std::vector<BVHPrim> &prims, int begin, int end, int depth,
+						std::vector<BVHNode> &out, int spawn_depth, std::atomic<int> &threads )
+{
+	int index = (int)out.size();
+	int count = end - begin;
+	Box3 box = EmptyBox();
+
+	out.push_back( BVHNode() );
+	for( int i = begin; i < end; i++ ) box = Union( box, prims[i].box );
+	out[index].box = box;
+
+	ObjectSplit best;
+	best.cost = Infinity;
+	best.axis = -1;
+	if( count > 1 && depth < MaxDepth ) best = FindObjectSplit( prims, begin, end, box );
+
+	int split;
+	if( best.axis < 0 || ( count <= MaxLeafSize && IntersectCost * count <= best.cost ) )
+	{
+		if( best.axis >= 0 || count <= MaxLeafSize || depth >= MaxDepth )
+		{
+			// Leaf node.
+			out[index].first  = 0;
+			out[index].offset = begin;
+			out[index].count  = count;
+			out[index].axis   = 0;
+			return index;
+		}
+		// Too many objects with coincident centers: split them in halves.
+		split = begin + count / 2;
+		best.axis = 0;
+	}
+	else
+	{
+		BVHPrim *middle = std::partition( &prims[0] + begin, &prims[0] + end, [&]( const BVHPrim &p )
+		{
+			return best.Bin( p ) < best.bin;
+		} );
+		split = (int)( middle - &prims[0] );
+	}
+
+	if( depth < spawn_depth && count >= ParallelSize )
+	{
+		// Build the second child on another thread into its own array, then
+		// append it after the first one and rebase its child indices.
+		std::vector<BVHNode> second_nodes;
+		threads++;
+		std::thread worker( [&]()
+		{
+			BuildBinned( prims, split, end, depth + 1, second_nodes, spawn_depth, threads );
+		} );
+		BuildBinned( prims, begin, split, depth + 1, out, spawn_depth, threads );
+		worker.join();
+
+		int base = (int)out.size();
+		for( size_t i = 0; i < second_nodes.size(); i++ )
+		{
+			if( second_nodes[i].count == 0 )
+			{
+				second_nodes[i].first  += base;
+				second_nodes[i].offset += base;
+			}
+			out.push_back( second_nodes[i] );
+		}
+		out[index].first  = index + 1;
+		out[index].offset = base;
+	}
+	else
+	{
+		BuildBinned( prims, begin, split, depth + 1, out, spawn_depth, threads );
+		int second = BuildBinned( prims, split, end, depth + 1, out, spawn_depth, threads );
+		out[index].first  = index + 1;
+		out[index].offset = second;
+	}
+	out[index].count = 0;
+	out[index].axis  = best.axis;
+	return index;
+}
+
+class SpatialSplit // Best spatial split found for a set of references.
+{
+	public:
+		double cost;		// SAH cost of the split, Infinity if none was found.
+		int    axis;		// Axis of the split plane, -1 if none was found.
+		double position;	// Coordinate of the plane along the axis.
+};
+
+static inline bool IsEmpty( const Box3 &box )
+{
+	return box.X.min > box.X.max || box.Y.min > box.Y.max || box.Z.min > box.Z.max;
+}
+
+// Cuts the box of the node into NumBins slabs per axis and clips every
+// reference to the slabs it spans.  A split at a slab boundary sends to
+// each child the references that enter its side, with the clipped bounds,
+// so the references that span the boundary are counted on both sides.
+static SpatialSplit FindSpatialSplit( const std::vector<BVHPrim> &refs, const Box3 &box )
+{
+	SpatialSplit best;
+	double area = SurfaceArea( box );
+
+	best.cost = Infinity;
+	best.axis = -1;
+	best.position = 0.0;
+
+	for( int axis = 0; axis < 3; axis++ )
+	{
+		Box3 bin_box[NumBins];
+		int  entries[NumBins];
+		int  exits[NumBins];
+		double right_area[NumBins];
+		int    right_count[NumBins];
+
+		double lo = Along( box, axis ).min;
+		double hi = Along( box, axis ).max;
+		if( hi <= lo ) continue;
+		double width = ( hi - lo ) / NumBins;
+
+		for( int b = 0; b < NumBins; b++ ) { bin_box[b] = EmptyBox(); entries[b] = exits[b] = 0; }
+		for( size_t i = 0; i < refs.size(); i++ )
+		{
+			int first = (int)( ( Along( refs[i].box, axis ).min - lo ) / width );
+			int last  = (int)( ( Along( refs[i].box, axis ).max - lo ) / width );
+			if( first >= NumBins ) first = NumBins - 1;
+			if( last >= NumBins ) last = NumBins - 1;
+			if( first < 0 ) first = 0;
+			if( last < first ) last = first;
+
+			// Chop the reference at every boundary it crosses.
+			Box3 rest = refs[i].box;
+			for( int b = first; b < last; b++ )
+			{
+				// Split writes its outputs before it is done with the box,
+				// so it must not be given "rest" for both.
+				Box3 piece, in = rest;
+				refs[i].object->Split( in, axis, lo + ( b + 1 ) * width, piece, rest );
+				bin_box[b] = Union( bin_box[b], piece );
+			}
+			bin_box[last] = Union( bin_box[last], rest );
+			entries[first]++;
+			exits[last]++;
+		}
+
+		Box3 right = EmptyBox();
+		int  n = 0;
+		for( int b = NumBins - 1; b > 0; b-- )
+		{
+			right = Union( right, bin_box[b] );
+			n += exits[b];
+			right_area[b]  = SurfaceArea( right );
+			right_count[b] = n;
+		}
+
+		Box3 left = EmptyBox();
+		n = 0;
+		for( int b = 1; b < NumBins; b++ )
+		{
+			left = Union( left, bin_box[b - 1] );
+			n += entries[b - 1];
+			if( n == 0 || right_count[b] == 0 ) continue;
+			double cost = TraversalCost + IntersectCost *
+				( SurfaceArea( left ) * n + right_area[b] * right_count[b] ) / ( area > 0.0 ? area : 1.0 );
+			if( cost < best.cost )
+			{
+				best.cost     = cost;
+				best.axis     = axis;
+				best.position = lo + b * width;
+			}
+		}
+	}
+	return best;
+}
+
+// Sends each reference to the side of the plane it lies on.  References
+// that cross it are split in two while the budget lasts, and sent whole to
+// the side of their center afterwards.
+static void SplitReferences( const std::vector<BVHPrim> &refs, const SpatialSplit &split, int &budget,
+							 std::vector<BVHPrim> &left, std::vector<BVHPrim> &right )
+{
+	for( size_t i = 0; i < refs.size(); i++ )
+	{
+		const BVHPrim &ref = refs[i];
+		const Interval &side = Along( ref.box, split.axis );
+
+		if( side.max <= split.position ) left.push_back( ref );
+		else if( side.min >= split.position ) right.push_back( ref );
+		else if( budget > 0 )
+		{
+			BVHPrim l = ref;
+			BVHPrim r = ref;
+			ref.object->Split( ref.box, split.axis, split.position, l.box, r.box );
+			l.center = Center( l.box );
+			r.center = Center( r.box );
+
+			// Clipping may find the object on one side only.
+			if( !IsEmpty( l.box ) ) left.push_back( l );
+			if( !IsEmpty( r.box ) ) right.push_back( r );
+			if( !IsEmpty( l.box ) && !IsEmpty( r.box ) ) budget--;
+			if( IsEmpty( l.box ) && IsEmpty( r.box ) ) left.push_back( ref );
+		}
+		else if( Component( ref.center, split.axis ) < split.position ) left.push_back( ref );
+		else right.push_back( ref );
+	}
+}
+
+void BVH::Build( Object *first )
+{
+	std::vector<BVHPrim> prims;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	nodes.clear();
+	objects.clear();
+	build_threads = 1;
+
+	for( Object *object = first; object != NULL; object = object->next )
+	{
+		BVHPrim prim;
+		prim.box    = object->GetBounds();
+		prim.center = Center( prim.box );
+		prim.object = object;
+		prims.push_back( prim );
+	}
+	if( prims.empty() ) return;
+
+	input_objects = (int)prims.size();
+	nodes.reserve( 2 * prims.size() );
+	if( build_method == BVH_SWEEP )
+	{
+		BuildNode( prims, 0, (int)prims.size(), 0 );
+	}
+	else if( build_method == BVH_SPATIAL )
+	{
+		// The leaves add their references to "objects" as they are made.
+		Box3 root = EmptyBox();
+		for( size_t i = 0; i < prims.size(); i++ ) root = Union( root, prims[i].box );
+		split_budget = (int)( MaxDuplication * prims.size() );
+		BuildSpatial( prims, 0, SurfaceArea( root ) );
+	}
+	else
+	{
+		// Spawn threads down to the depth that gives about two subtrees per core.
+		std::atomic<int> threads( 1 );
+		int cores = (int)std::thread::hardware_concurrency();
+		int spawn_depth = 0;
+		while( ( 1 << spawn_depth ) < 2 * cores ) spawn_depth++;
+		std::vector<BVHNode> built;
+		built.reserve( 2 * prims.size() );
+		BuildBinned( prims, 0, (int)prims.size(), 0, built, spawn_depth, threads );
+		nodes.swap( built );
+		build_threads = threads;
+	}
+
+	// The leaves index the build records, which are now in their final order.
+	if( build_method != BVH_SPATIAL )
+	{
+		objects.resize( prims.size() );
+		for( size_t i = 0; i < prims.size(); i++ ) objects[i] = prims[i].object;
+	}
+
+	if( layout != BVH_LAYOUT_BUILD ) Reorder( layout );
+	else
+	{
+		LinkParents();
+		primitives.Compile( objects );
+	}
+
+	build_time = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+	build_cost = BaselineCost();
+}
+
+// Lists the subtree of "index" depth-first, always going down the child
+// with the larger box first, which is the one a ray is more likely to
+// enter, so that it lands right after its parent.
+static void LayoutDepthFirst( const NodeArray<BVHNode> &nodes, int index, std::vector<int> &order )
+{
+	order.push_back( index );
+	const BVHNode &node = nodes[index];
+	if( node.count > 0 ) return;
+
+	bool swap = SurfaceArea( nodes[node.offset].box ) > SurfaceArea( nodes[node.first].box );
+	LayoutDepthFirst( nodes, swap ? node.offset : node.first, order );
+	LayoutDepthFirst( nodes, swap ? node.first : node.offset, order );
+}
+
+// Collects the nodes "depth" levels below "index".
+static void CollectLevel( const NodeArray<BVHNode> &nodes, int index, int depth, std::vector<int> &level )
+{
+	const BVHNode &node = nodes[index];
+	if( depth == 0 ) level.push_back( index );
+	else if( node.count == 0 )
+	{
+		CollectLevel( nodes, node.first, depth - 1, level );
+		CollectLevel( nodes, node.offset, depth - 1, level );
+	}
+}
+
+// Lists the top "levels" levels of the subtree of "index" in van Emde Boas
+// order: the upper half of the levels first, then each of the subtrees
+// hanging from it, all laid out the same way.  Every treelet ends up
+// contiguous, whatever the size of the cache lines and pages.
+static void LayoutVEB( const NodeArray<BVHNode> &nodes, int index, int levels, std::vector<int> &order )
+{
+	if( levels == 1 || nodes[index].count > 0 )
+	{
+		order.push_back( index );
+		return;
+	}
+
+	int top = levels / 2;
+	LayoutVEB( nodes, index, top, order );
+
+	std::vector<int> bottom;
+	CollectLevel( nodes, index, top, bottom );
+	for( size_t i = 0; i < bottom.size(); i++ ) LayoutVEB( nodes, bottom[i], levels - top, order );
+}
+
+// Both layouts keep every node before its children, which Refit relies on.
+void BVH::Reorder( BVHLayout node_layout, bool objects_too )
+{
+	std::vector<int> order;
+
+	if( nodes.empty() ) return;
+	order.reserve( nodes.size() );
+
+	if( node_layout == BVH_LAYOUT_DFS ) LayoutDepthFirst( nodes, 0, order );
+	else if( node_layout == BVH_LAYOUT_VEB )
+	{
+		// Height of every subtree; children come after their parent.
+		std::vector<int> height( nodes.size(), 1 );
+		for( int i = NumNodes() - 1; i >= 0; i-- )
+		{
+			if( nodes[i].count == 0 )
+				height[i] = 1 + std::max( height[nodes[i].first], height[nodes[i].offset] );
+		}
+		LayoutVEB( nodes, 0, height[0], order );
+	}
+	else
+	{
+		// Back to plain depth-first, first child first.
+		std::vector<int> stack( 1, 0 );
+		while( !stack.empty() )
+		{
+			int index = stack.back();
+			stack.pop_back();
+			order.push_back( index );
+			if( nodes[index].count == 0 )
+			{
+				stack.push_back( nodes[index].offset );
+				stack.push_back( nodes[index].first );
+			}
+		}
+	}
+
+	std::vector<int> position( nodes.size() );
+	for( size_t i = 0; i < order.size(); i++ ) position[order[i]] = (int)i;
+
+	std::vector<BVHNode> moved( nodes.size() );
+	std::vector<Object*> leaf_objects;
+	if( objects_too ) leaf_objects.reserve( objects.size() );
+
+	for( size_t i = 0; i < order.size(); i++ )
+	{
+		BVHNode node = nodes[order[i]];
+		if( node.count == 0 )
+		{
+			node.first  = position[node.first];
+			node.offset = position[node.offset];
+		}
+		else if( objects_too )
+		{
+			// The objects of the leaves, in the order the leaves are now stored.
+			int offset = (int)leaf_objects.size();
+			leaf_objects.insert( leaf_objects.end(), objects.begin() + node.offset, objects.begin() + node.offset + node.count );
+			node.offset = offset;
+		}
+		moved[i] = node;
+	}
+
+	nodes.swap( moved );
+	if( objects_too )
+	{
+		objects.swap( leaf_objects );
+		primitives.Compile( objects );
+	}
+	LinkParents();
+}
+
+void BVH::LinkParents()
+{
+	// Read through GetNode, which does not copy nodes that are still mapped.
+	parents.assign( nodes.size(), -1 );
+	for( int i = 0; i < NumNodes(); i++ )
+	{
+		const BVHNode &node = GetNode( i );
+		if( node.count == 0 ) parents[node.first] = parents[node.offset] = i;
+	}
+}
+
+// Children are always stored after their parent, so walking the array
+// backwards visits both children of a node before the node itself.  The
+// leaves of a spatial split tree get the whole bounds of their objects
+// back, not the clipped ones, so it refits looser than it was built (see
+// BaselineCost).
+void BVH::Refit()
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	for( int i = NumNodes() - 1; i >= 0; i-- )
+	{
+		BVHNode &node = nodes[i];
+		if( node.count > 0 )
+		{
+			node.box = EmptyBox();
+			for( int j = node.offset; j < node.offset + node.count; j++ )
+				node.box = Union( node.box, objects[j]->GetBounds() );
+		}
+		else node.box = Union( nodes[node.first].box, nodes[node.offset].box );
+	}
+	primitives.Compile( objects );
+
+	refit_time = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+}
+
+// Sum of the areas of the nodes, each weighted by the cost of a traversal
+// step for inner nodes or of intersecting its objects for leaves.  It is
+// divided by the areas of the objects rather than by that of the root, so
+// that it does not change when the whole scene grows or shrinks, but only
+// when the boxes become loose around the objects they hold.
+double BVH::Cost() const
+{
+	double cost = 0.0;
+
+	for( int i = 0; i < NumNodes(); i++ )
+	{
+		double work = nodes[i].count > 0 ? IntersectCost * nodes[i].count : TraversalCost;
+		cost += SurfaceArea( nodes[i].box ) * work;
+	}
+
+	double object_area = ObjectArea();
+	return object_area > 0.0 ? cost / object_area : cost;
+}
+
+// The cost Update compares the refitted tree with.  A refit gives the
+// leaves of a spatial split tree the whole bounds of their objects, so
+// comparing with the cost of the clipped boxes would rebuild it after every
+// refit, even one where nothing moved.  Its baseline is instead the cost
+// the tree has once refitted in place, worked out on a copy of the boxes.
+double BVH::BaselineCost() const
+{
+	if( build_method != BVH_SPATIAL ) return Cost();
+
+	std::vector<Box3> boxes( NumNodes() );
+	double cost = 0.0;
+
+	for( int i = NumNodes() - 1; i >= 0; i-- )
+	{
+		const BVHNode &node = nodes[i];
+		if( node.count > 0 )
+		{
+			boxes[i] = EmptyBox();
+			for( int j = node.offset; j < node.offset + node.count; j++ )
+				boxes[i] = Union( boxes[i], objects[j]->GetBounds() );
+		}
+		else boxes[i] = Union( boxes[node.first], boxes[node.offset] );
+
+		double work = node.count > 0 ? IntersectCost * node.count : TraversalCost;
+		cost += SurfaceArea( boxes[i] ) * work;
+	}
+
+	double object_area = ObjectArea();
+	return object_area > 0.0 ? cost / object_area : cost;
+}
+
+// Sum of the areas of the bounds of the objects.  Spatial splits reference
+// some objects more than once; they are counted once.
+double BVH::ObjectArea() const
+{
+	double object_area = 0.0;
+	std::vector<Object*> distinct( objects );
+	if( build_method == BVH_SPATIAL )
+	{
+		std::sort( distinct.begin(), distinct.end() );
+		distinct.erase( std::unique( distinct.begin(), distinct.end() ), distinct.end() );
+	}
+	for( size_t i = 0; i < distinct.size(); i++ ) object_area += SurfaceArea( distinct[i]->GetBounds() );
+	return object_area;
+}
+
+bool BVH::Save( const char *file_name, unsigned long long key, Object *first ) const
+{
+	return SaveNodes( file_name, Name(), key, nodes, objects, first );
+}
+
+bool BVH::Load( const char *file_name, unsigned long long key, Object *first )
+{
+	if( !LoadNodes( file_name, Name(), key, nodes, objects, first ) ) return false;
+
+	LinkParents();
+	primitives.Compile( objects );
+	build_threads = 0;
+	input_objects = 0;
+	for( Object *object = first; object != NULL; object = object->next ) input_objects++;
+	build_cost = BaselineCost();
+	return true;
+}
+
+void BVH::Report( ostream &out ) const
+{
+	out << ( build_method == BVH_SPATIAL ? "Spatial split BVH" : "BVH" ) << " built in " << build_time * 1000.0 << " ms: "
+		<< NumNodes() << " nodes over " << input_objects << " objects, ";
+	if( build_method == BVH_SPATIAL )
+		out << NumObjects() - input_objects << " extra references, ";
+	out << build_threads << " threads, SAH cost " << Cost();
+	if( build_method == BVH_SPATIAL ) out << " (" << build_cost << " refitted)";
+	out << "." << endl;
+}
+
+void BVH::GetTreeStats( TreeStats &stats ) const
+{
+	std::vector< std::pair<int, int> > stack;	// Nodes left to visit, with their depth.
+
+	if( !nodes.empty() ) stack.push_back( std::make_pair( 0, 0 ) );
+	while( !stack.empty() )
+	{
+		const BVHNode &node = nodes[stack.back().first];
+		int depth = stack.back().second;
+		stack.pop_back();
+
+		if( node.count > 0 ) stats.AddLeaf( node.count, depth );
+		else
+		{
+			stack.push_back( std::make_pair( node.first, depth + 1 ) );
+			stack.push_back( std::make_pair( node.offset, depth + 1 ) );
+		}
+	}
+}
+
+// Builds the subtree for prims[begin, end) and returns the index of its root.
+// Every axis is sorted and swept to evaluate the SAH cost of splitting
+// between each pair of consecutive objects; the node becomes a leaf when
+// no split is cheaper than intersecting all of its objects.
+int BVH::BuildNode( std::vector<BVHPrim> &prims, int begin, int end, int depth )
+{
+	int index = (int)nodes.size();
+	int count = end - begin;
+	Box3 box = EmptyBox();
+
+	nodes.push_back( BVHNode() );
+	for( int i = begin; i < end; i++ ) box = Union( box, prims[i].box );
+	nodes[index].box = box;
+
+	double best_cost  = Infinity;
+	int    best_axis  = -1;
+	int    best_split = 0;
+
+	if( count > 1 && depth < MaxDepth )
+	{
+		std::vector<double> right_area( count );
+		double area = SurfaceArea( box );
+
+		for( int axis = 0; axis < 3; axis++ )
+		{
+			std::sort( prims.begin() + begin, prims.begin() + end, CenterLess( axis ) );
+
+			// Area of the boxes of prims[i, end), swept from the right.
+			Box3 right = EmptyBox();
+			for( int i = count - 1; i > 0; i-- )
+			{
+				right = Union( right, prims[begin + i].box );
+				right_area[i] = SurfaceArea( right );
+			}
+
+			// Cost of splitting into prims[begin, begin + i) and the rest.
+			Box3 left = EmptyBox();
+			for( int i = 1; i < count; i++ )
+			{
+				left = Union( left, prims[begin + i - 1].box );
+				double cost = TraversalCost + IntersectCost *
+					( SurfaceArea( left ) * i + right_area[i] * ( count - i ) ) / ( area > 0.0 ? area : 1.0 );
+				if( cost < best_cost )
+				{
+					best_cost  = cost;
+					best_axis  = axis;
+					best_split = i;
+				}
+			}
+		}
+	}
+
+	if( best_axis < 0 || ( count <= MaxLeafSize && IntersectCost * count <= best_cost ) )
+	{
+		// Leaf node.
+		nodes[index].first  = 0;
+		nodes[index].offset = begin;
+		nodes[index].count  = count;
+		nodes[index].axis   = 0;
+		return index;
+	}
+
+	// The last axis swept was Z, so the records may need sorting again.
+	if( best_axis != 2 )
+		std::sort( prims.begin() + begin, prims.begin() + end, CenterLess( best_axis ) );
+
+	BuildNode( prims, begin, begin + best_split, depth + 1 );
+	int second = BuildNode( prims, begin + best_split, end, depth + 1 );
+
+	nodes[index].first  = index + 1;
+	nodes[index].offset = second;
+	nodes[index].count  = 0;
+	nodes[index].axis   = best_axis;
+	return index;
+}
+
+// Spatial split builder.  Builds the subtree for the references in "refs",
+// which it consumes, choosing between the best object split and the best
+// spatial split.  Spatial splits are only tried where the children of the
+// object split overlap, which is where they can help.
+int BVH::BuildSpatial( std::vector<BVHPrim> &refs, int depth, double root_area )
+{
+	int index = (int)nodes.size();
+	int count = (int)refs.size();
+	Box3 box = EmptyBox();
+
+	nodes.push_back( BVHNode() );
+	for( int i = 0; i < count; i++ ) box = Union( box, refs[i].box );
+	nodes[index].box = box;
+
+	ObjectSplit  object_split;
+	SpatialSplit spatial_split;
+	object_split.cost  = spatial_split.cost = Infinity;
+	object_split.axis  = spatial_split.axis = -1;
+
+	if( count > 1 && depth < MaxDepth )
+	{
+		object_split = FindObjectSplit( refs, 0, count, box );
+		if( split_budget > 0 && ( object_split.axis < 0 ||
+			SurfaceArea( Intersection( object_split.left, object_split.right ) ) > SpatialOverlap * root_area ) )
+			spatial_split = FindSpatialSplit( refs, box );
+	}
+
+	bool   spatial   = spatial_split.cost < object_split.cost;
+	int    best_axis = spatial ? spatial_split.axis : object_split.axis;
+	double best_cost = spatial ? spatial_split.cost : object_split.cost;
+
+	std::vector<BVHPrim> left;
+	std::vector<BVHPrim> right;
+
+	if( best_axis < 0 || ( count <= MaxLeafSize && IntersectCost * count <= best_cost ) )
+	{
+		if( best_axis >= 0 || count <= MaxLeafSize || depth >= MaxDepth )
+		{
+			// Leaf node.
+			nodes[index].first  = 0;
+			nodes[index].offset = (int)objects.size();
+			nodes[index].count  = count;
+			nodes[index].axis   = 0;
+			for( int i = 0; i < count; i++ ) objects.push_back( refs[i].object );
+			return index;
+		}
+		// Too many objects with coincident centers: split them in halves.
+		left.assign( refs.begin(), refs.begin() + count / 2 );
+		right.assign( refs.begin() + count / 2, refs.end() );
+		best_axis = 0;
+	}
+	else if( spatial )
+	{
+		SplitReferences( refs, spatial_split, split_budget, left, right );
+	}
+	else
+	{
+		for( int i = 0; i < count; i++ )
+			( object_split.Bin( refs[i] ) < object_split.bin ? left : right ).push_back( refs[i] );
+	}
+
+	// Clipping can leave a side of a spatial split empty; no reference was
+	// duplicated then, so the object split, or halves, can be used instead.
+	if( left.empty() || right.empty() )
+	{
+		left.clear();
+		right.clear();
+		if( object_split.axis >= 0 )
+		{
+			for( int i = 0; i < count; i++ )
+				( object_split.Bin( refs[i] ) < object_split.bin ? left : right ).push_back( refs[i] );
+			best_axis = object_split.axis;
+		}
+		else
+		{
+			left.assign( refs.begin(), refs.begin() + count / 2 );
+			right.assign( refs.begin() + count / 2, refs.end() );
+			best_axis = 0;
+		}
+	}
+
+	// The references of this node are not needed any more.
+	std::vector<BVHPrim>().swap( refs );
+
+	BuildSpatial( left, depth + 1, root_area );
+	int second = BuildSpatial( right, depth + 1, root_area );
+
+	nodes[index].first  = index + 1;
+	nodes[index].offset = second;
+	nodes[index].count  = 0;
+	nodes[index].axis   = best_axis;
+	return index;
+}
+
+const Object *BVH::Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore ) const
+{
+	QueryCount work;
+	const Object *hit = NULL;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( nodes.empty() ) return NULL;
+
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+	bool negative[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	for(;;)
+	{
+		const BVHNode &node = nodes[current];
+		work.nodes++;
+
+		// hitgeom.distance shrinks as closer hits are found, culling the boxes behind them.
+		if( HitBox( node.box, ray.origin, inv_dir, hitgeom.distance ) )
+		{
+			if( node.count > 0 )
+			{
+				for( int i = node.offset; i < node.offset + node.count; i++ )
+				{
+					work.primitives++;
+					const Object *object = primitives.Hit( i, ray, hitgeom, ignore );
+					if( object != NULL ) hit = object;
+				}
+			}
+			else
+			{
+				// Visit the child nearer to the ray origin first.
+				if( negative[node.axis] )
+				{
+					stack[sp++] = node.first;
+					current = node.offset;
+				}
+				else
+				{
+					stack[sp++] = node.offset;
+					current = node.first;
+				}
+				continue;
+			}
+		}
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return hit;
+}
+
+// Any-hit traversal: the children are visited in a fixed order, since
+// there is no closest hit to cull against, and the first object that
+// blocks the ray ends the search.
+bool BVH::Occluded( const Ray &ray, double max_distance, const Object *ignore ) const
+{
+	QueryCount work;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( nodes.empty() ) return false;
+
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+
+	for(;;)
+	{
+		const BVHNode &node = nodes[current];
+		work.nodes++;
+
+		if( HitBox( node.box, ray.origin, inv_dir, max_distance ) )
+		{
+			if( node.count > 0 )
+			{
+				for( int i = node.offset; i < node.offset + node.count; i++ )
+				{
+					work.primitives++;
+					if( primitives.Occludes( i, ray, max_distance, ignore ) ) return true;
+				}
+			}
+			else
+			{
+				stack[sp++] = node.offset;
+				current = node.first;
+				continue;
+			}
+		}
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return false;
+}
+
+// Child of an inner node that a ray crosses first, and the other one.
+static inline int NearChild( const BVHNode &node, const bool negative[3] )
+{
+	return negative[node.axis] ? node.offset : node.first;
+}
+
+static inline int FarChild( const BVHNode &node, const bool negative[3] )
+{
+	return negative[node.axis] ? node.first : node.offset;
+}
+
+// Stackless traversal.  The state of the ray is the current node and how
+// it was reached: from its parent, as the nearer child; from its sibling,
+// as the farther one; or from one of its own children, on the way back up.
+// A node reached from above is tested and the ray goes down into it or, if
+// it is missed or a leaf, moves on to where a stack would have popped next:
+// the sibling if it was the nearer child, otherwise back up.  The walk is
+// over when it climbs back to the root.
+const Object *BVH::IntersectStackless( const Ray &ray, HitGeom &hitgeom, const Object *ignore ) const
+{
+	QueryCount work;
+	enum { FROM_PARENT, FROM_SIBLING, FROM_CHILD };
+	const Object *hit = NULL;
+
+	if( nodes.empty() ) return NULL;
+
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+	bool negative[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	int current = 0;
+	int state   = FROM_SIBLING;	// The root has no sibling, so it is left upwards and ends the walk.
+
+	for(;;)
+	{
+		if( state == FROM_CHILD )
+		{
+			if( current == 0 ) break;
+			const BVHNode &parent = nodes[parents[current]];
+			if( current == NearChild( parent, negative ) )
+			{
+				current = FarChild( parent, negative );
+				state = FROM_SIBLING;
+			}
+			else current = parents[current];
+			continue;
+		}
+
+		const BVHNode &node = nodes[current];
+		work.nodes++;
+		if( HitBox( node.box, ray.origin, inv_dir, hitgeom.distance ) )
+		{
+			if( node.count == 0 )
+			{
+				current = NearChild( node, negative );
+				state = FROM_PARENT;
+				continue;
+			}
+			for( int i = node.offset; i < node.offset + node.count; i++ )
+			{
+				work.primitives++;
+				const Object *object = primitives.Hit( i, ray, hitgeom, ignore );
+				if( object != NULL ) hit = object;
+			}
+		}
+
+		if( current == 0 ) break;
+		if( state == FROM_PARENT )
+		{
+			current = FarChild( nodes[parents[current]], negative );
+			state = FROM_SIBLING;
+		}
+		else
+		{
+			current = parents[current];
+			state = FROM_CHILD;
+		}
+	}
+	return hit;
+}
+
+// Same walk with the children always taken in stored order, as Occluded
+// does.
+bool BVH::OccludedStackless( const Ray &ray, double max_distance, const Object *ignore ) const
+{
+	QueryCount work;
+	enum { FROM_PARENT, FROM_SIBLING, FROM_CHILD };
+
+	if( nodes.empty() ) return false;
+
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+
+	int current = 0;
+	int state   = FROM_SIBLING;
+
+	for(;;)
+	{
+		if( state == FROM_CHILD )
+		{
+			if( current == 0 ) break;
+			const BVHNode &parent = nodes[parents[current]];
+			if( current == parent.first )
+			{
+				current = parent.offset;
+				state = FROM_SIBLING;
+			}
+			else current = parents[current];
+			continue;
+		}
+
+		const BVHNode &node = nodes[current];
+		work.nodes++;
+		if( HitBox( node.box, ray.origin, inv_dir, max_distance ) )
+		{
+			if( node.count == 0 )
+			{
+				current = node.first;
+				state = FROM_PARENT;
+				continue;
+			}
+			for( int i = node.offset; i < node.offset + node.count; i++ )
+			{
+				work.primitives++;
+				if( primitives.Occludes( i, ray, max_distance, ignore ) ) return true;
+			}
+		}
+
+		if( current == 0 ) break;
+		if( state == FROM_PARENT )
+		{
+			current = nodes[parents[current]].offset;
+			state = FROM_SIBLING;
+		}
+		else
+		{
+			current = parents[current];
+			state = FROM_CHILD;
+		}
+	}
+	return false;
+}
\ No newline at end of file
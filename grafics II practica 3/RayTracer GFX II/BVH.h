@@ -0,0 +1,156 @@
+#ifndef BVH_H
+#define BVH_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines a bounding volume hierarchy (BVH) over the objects of  *
+* a scene.  Every node stores the box that bounds all the objects below    *
+* it, so a ray that misses the box can skip the whole subtree.  The tree   *
+* is built top-down choosing, at each node, the split that minimizes the   *
+* surface area heuristic (SAH): the expected cost of tracing a random ray  *
+* through the two children, where the probability of hitting a child is    *
+* proportional to the surface area of its box.                             *
+*                                                                          *
+* Nodes are stored in a flat array, every inner node before its children,  *
+* whose indices it records.  The builders leave them in depth-first order. *
+* Afterwards the nodes can be reordered so that the ones a ray visits one  *
+* after the other share cache lines (see BVHLayout), and the objects along *
+* with them so that those of a leaf sit next to those of nearby leaves.    *
+* The parent of every node is kept in a separate array, which lets a ray   *
+* walk the tree without a stack: from each node it goes down to the nearer *
+* child, across to the sibling, or back up, depending on where it came     *
+* from.                                                                    *
+*                                                                          *
+* Two builders are available.  The sweep builder sorts the objects along   *
+* every axis and evaluates every possible split; it finds the best split   *
+* but costs O(n log^2 n).  The binned builder drops the object centers     *
+* into a fixed number of bins per axis and only evaluates the bin          *
+* boundaries, which is linear per level and close in quality.  It also     *
+* hands large subtrees to other threads, so it is the one used to load     *
+* scenes.                                                                  *
+*                                                                          *
+* The spatial split builder (SBVH) also considers cutting the node with a  *
+* plane and sending each object to the side, or sides, it lies in.  An     *
+* object that crosses the plane is then referenced by both children, each  *
+* with the bounds of its own part (see Object::Split), which keeps long    *
+* thin triangles from making the boxes of both children overlap.  The      *
+* number of extra references is capped, and once the budget is spent the   *
+* builder falls back to object splits.                                     *
+*                                                                          *
+***************************************************************************/
+
+#include <vector>
+
+#include "Accelerator.h"
+#include "Cache.h"
+#include "Primitives.h"
+
+enum BVHBuildMethod // How the split of every node is chosen.
+{
+	BVH_SWEEP,		// Full SAH sweep over the sorted objects, single threaded.
+	BVH_BINNED,		// Binned SAH, with subtrees built in parallel.
+	BVH_SPATIAL		// Binned SAH with spatial splits, single threaded.
+};
+
+enum BVHLayout // Order of the nodes in memory, chosen after the build.
+{
+	BVH_LAYOUT_BUILD,	// Depth-first, the first child of every node right after it.
+	BVH_LAYOUT_DFS,		// Depth-first, the child with the larger box right after its parent.
+	BVH_LAYOUT_VEB		// Van Emde Boas: the tree is cut at half its height into treelets,
+						// each stored contiguously and laid out the same way recursively.
+};
+
+class BVHNode // A node of the hierarchy.
+{
+	public:
+		Box3 box;		// Bounds of all the objects below this node.
+		int  first;		// Inner node: index of its first child.
+		int  offset;	// Leaf: index of its first object. Inner node: index of its second child.
+		int  count;		// Number of objects in a leaf, 0 for inner nodes.
+		int  axis;		// Axis used to split an inner node; the first child is on its lower side.
+};
+
+class BVHPrim // Build-time record of an object to be placed in the hierarchy.
+{
+	public:
+		Box3    box;	// Bounds of the object.
+		Vec3    center;	// Center of the bounds, used to sort the objects.
+		Object *object;
+		int     index;	// Part of the object, for hierarchies over the parts of one object.
+};
+
+class ObjectSplit // Best binned object split found for a range of build records.
+{
+	public:
+		double cost;	// SAH cost of the split, Infinity if none was found.
+		int    axis;	// Axis of the split, -1 if none was found.
+		int    bin;		// Records whose center falls in a lower bin go to the first child.
+		double lo;		// Maps a center along "axis" to its bin.
+		double scale;
+		Box3   left;	// Bounds of the two children.
+		Box3   right;
+
+		int Bin( const BVHPrim &prim ) const;
+};
+
+// Best binned SAH split of prims[begin, end), whose bounds are "box".  Also
+// used by the lazy builder (see LazyBVH.h) and by TriangleMesh.
+ObjectSplit FindObjectSplit( const std::vector<BVHPrim> &prims, int begin, int end, const Box3 &box );
+
+class BVH : public Accelerator
+{
+	public:
+		int build_threads;	// Number of threads that took part in the last build.
+		int input_objects;	// Objects in the list the hierarchy was built over.
+
+		BVH( BVHBuildMethod method = BVH_BINNED, BVHLayout node_layout = BVH_LAYOUT_BUILD )
+		{
+			build_method = method;
+			layout = node_layout;
+			build_threads = input_objects = 0;
+		}
+		virtual ~BVH() {}
+
+		void Build( Object *first );
+		const Object *Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore = NULL ) const;
+		bool Occluded( const Ray &ray, double max_distance, const Object *ignore = NULL ) const;
+		const Object *IntersectStackless( const Ray &ray, HitGeom &hitgeom, const Object *ignore = NULL ) const;
+		bool OccludedStackless( const Ray &ray, double max_distance, const Object *ignore = NULL ) const;
+		void Refit();
+		double Cost() const;
+		bool Cacheable() const { return true; }
+		bool Save( const char *file_name, unsigned long long key, Object *first ) const;
+		bool Load( const char *file_name, unsigned long long key, Object *first );
+		const char *Name() const { return build_method == BVH_SPATIAL ? "sbvh" : "bvh"; }
+		void Report( ostream &out ) const;
+		void GetTreeStats( TreeStats &stats ) const;
+
+		// Moves the nodes into the given layout and, with "objects_too",
+		// the objects into the order in which the leaves are stored.
+		void Reorder( BVHLayout node_layout, bool objects_too = true );
+
+		int NumNodes() const { return (int)nodes.size(); }
+		int NumObjects() const { return (int)objects.size(); }	// References, with spatial splits.
+
+		// Read access for the structures that are derived from a binary tree.
+		const BVHNode &GetNode( int i ) const { return nodes[i]; }
+		Box3 GetBounds() const { return nodes.empty() ? EmptyBox() : nodes[0].box; }
+		Object *GetObject( int i ) const { return objects[i]; }
+
+	private:
+		BVHBuildMethod       build_method;
+		BVHLayout            layout;	// Layout the nodes are moved into after every build.
+		NodeArray<BVHNode>   nodes;
+		std::vector<Object*> objects;	// Objects referenced by the leaves.
+		Primitives           primitives;	// The same objects compiled, which the leaves test.
+		std::vector<int>     parents;	// Index of the parent of every node, -1 for the root.
+		int                  split_budget;	// References the spatial builder may still add.
+
+		int BuildNode( std::vector<BVHPrim> &prims, int begin, int end, int depth );
+		int BuildSpatial( std::vector<BVHPrim> &refs, int depth, double root_area );
+		void LinkParents();
+		double BaselineCost() const;
+		double ObjectArea() const;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <map>
+
+#include "Cache.h"
+
+#if defined( _WIN32 )
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+static const char Magic[8] = "RTCACH2";
+
+// The nodes are read in place right after the header, so it must keep
+// them aligned for the doubles of their boxes.
+static_assert( sizeof( CacheHeader ) % 8 == 0, "CacheHeader must keep the nodes aligned" );
+
+unsigned long long SceneHash( Object *first )
+{
+	unsigned long long hash = 14695981039346656037ULL;	// FNV-1a offset basis.
+
+	for( Object *object = first; object != NULL; object = object->next ) hash = object->Hash( hash );
+	return hash;
+}
+
+MappedFile::MappedFile( const char *file_name )
+{
+	data = NULL;
+	size = 0;
+	handle = mapping = NULL;
+
+#if defined( _WIN32 )
+	HANDLE file = CreateFileA( file_name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if( file == INVALID_HANDLE_VALUE ) return;
+
+	LARGE_INTEGER length;
+	HANDLE map = NULL;
+	if( GetFileSizeEx( file, &length ) && length.QuadPart > 0 )
+		map = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if( map == NULL )
+	{
+		CloseHandle( file );
+		return;
+	}
+	handle  = file;
+	mapping = map;
+	data = (const char *)MapViewOfFile( map, FILE_MAP_READ, 0, 0, 0 );
+	if( data != NULL ) size = (size_t)length.QuadPart;
+#else
+	int fd = open( file_name, O_RDONLY );
+	if( fd < 0 ) return;
+
+	struct stat info;
+	if( fstat( fd, &info ) == 0 && info.st_size > 0 )
+	{
+		void *view = mmap( NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if( view != MAP_FAILED )
+		{
+			data = (const char *)view;
+			size = (size_t)info.st_size;
+		}
+	}
+	// The mapping stays valid after the descriptor is closed.
+	close( fd );
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#if defined( _WIN32 )
+	if( data != NULL ) UnmapViewOfFile( data );
+	if( mapping != NULL ) CloseHandle( (HANDLE)mapping );
+	if( handle != NULL ) CloseHandle( (HANDLE)handle );
+#else
+	if( data != NULL ) munmap( (void *)data, size );
+#endif
+}
+
+bool WriteCache( const char *file_name, const char *name, unsigned long long key, int node_size,
+				 const void *nodes, int num_nodes, const std::vector<Object*> &objects, Object *first )
+{
+	// Objects are stored as their position in the list of the scene.
+	std::map<const Object*, int> position;
+	int n = 0;
+	for( Object *object = first; object != NULL; object = object->next ) position[object] = n++;
+
+	std::vector<int> indices( objects.size() );
+	for( size_t i = 0; i < objects.size(); i++ )
+	{
+		std::map<const Object*, int>::iterator it = position.find( objects[i] );
+		if( it == position.end() ) return false;
+		indices[i] = it->second;
+	}
+
+	CacheHeader header;
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, Magic, sizeof( header.magic ) );
+	strncpy( header.name, name, sizeof( header.name ) - 1 );
+	header.key         = key;
+	header.node_size   = node_size;
+	header.num_nodes   = num_nodes;
+	header.num_objects = (int)indices.size();
+
+	FILE *fp = fopen( file_name, "wb" );
+	if( fp == NULL ) return false;
+
+	bool ok = fwrite( &header, sizeof( header ), 1, fp ) == 1
+		   && fwrite( nodes, node_size, num_nodes, fp ) == (size_t)num_nodes
+		   && ( indices.empty() || fwrite( &indices[0], sizeof( int ), indices.size(), fp ) == indices.size() );
+	ok = ( fclose( fp ) == 0 ) && ok;
+
+	// Never leave a truncated file behind for the next run to read.
+	if( !ok ) remove( file_name );
+	return ok;
+}
+
+const char *ReadCache( const MappedFile &file, const char *name, unsigned long long key, int node_size,
+					   int &num_nodes, std::vector<Object*> &objects, Object *first )
+{
+	CacheHeader header;
+
+	if( file.data == NULL || file.size < sizeof( header ) ) return NULL;
+	memcpy( &header, file.data, sizeof( header ) );
+
+	if( memcmp( header.magic, Magic, sizeof( header.magic ) ) != 0 ) return NULL;
+	if( strncmp( header.name, name, sizeof( header.name ) ) != 0 ) return NULL;
+	if( header.key != key || header.node_size != node_size ) return NULL;
+	if( header.num_nodes <= 0 || header.num_objects < 0 ) return NULL;
+	if( file.size != sizeof( header ) + (size_t)header.num_nodes * node_size + (size_t)header.num_objects * sizeof( int ) ) return NULL;
+
+	std::vector<Object*> list;
+	for( Object *object = first; object != NULL; object = object->next ) list.push_back( object );
+
+	const char *indices = file.data + sizeof( header ) + (size_t)header.num_nodes * node_size;
+	std::vector<Object*> found( header.num_objects );
+	for( int i = 0; i < header.num_objects; i++ )
+	{
+		int index;
+		memcpy( &index, indices + i * sizeof( int ), sizeof( int ) );
+		if( index < 0 || index >= (int)list.size() ) return NULL;
+		found[i] = list[index];
+	}
+
+	objects.swap( found );
+	num_nodes = header.num_nodes;
+	return file.data + sizeof( header );
+}
\ No newline at end of file
@@ -0,0 +1,141 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines the on-disk cache of acceleration structures.  Once    *
+* built, a structure is written next to the scene file as a header         *
+* followed by two flat arrays: its nodes, which only hold boxes and        *
+* indices, and its objects, each stored as its position in the object      *
+* list of the scene.  The header records a hash of the type and geometry   *
+* of all the objects, in order, which is all the build depends on; a later *
+* run over the same objects finds the same hash and maps the file into     *
+* memory instead of building the structure again.                          *
+*                                                                          *
+* The nodes are not copied out of the mapping: the structure keeps the     *
+* file mapped in its NodeArray and its queries read them where they are,   *
+* so only the pages the rays touch are ever read from the disk.  The first *
+* change to them, a refit, copies them into memory of its own.             *
+*                                                                          *
+***************************************************************************/
+
+#include <string.h>
+#include <memory>
+#include <vector>
+
+#include "Object.h"
+
+// Hash of the objects in the list that starts at "first", see Object::Hash.
+unsigned long long SceneHash( Object *first );
+
+class MappedFile // A file mapped read-only into memory.
+{
+	public:
+		const char *data;	// Contents of the file, NULL if it could not be mapped.
+		size_t      size;
+
+		MappedFile( const char *file_name );
+		~MappedFile();
+
+	private:
+		void *handle;		// Windows: the file and its mapping.
+		void *mapping;
+
+		MappedFile( const MappedFile & );	// Not copyable: the mapping is released once.
+		MappedFile &operator=( const MappedFile & );
+};
+
+// The nodes of a structure.  They are either built in a vector of their
+// own or read in place from a mapped cache file, which the array then keeps
+// mapped.  Reading them, through the const operator[], costs the same
+// either way.  Anything that changes them copies the mapped nodes into the
+// vector first and lets the mapping go.
+template <class Node>
+class NodeArray
+{
+	public:
+		NodeArray() { data = NULL; count = 0; }
+
+		const Node &operator[]( size_t i ) const { return data[i]; }
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+
+		Node &operator[]( size_t i ) { Own(); return owned[i]; }
+		void clear() { file.reset(); owned.clear(); Sync(); }
+		void reserve( size_t n ) { Own(); owned.reserve( n ); Sync(); }
+		void resize( size_t n ) { Own(); owned.resize( n ); Sync(); }
+		void push_back( const Node &node ) { Own(); owned.push_back( node ); Sync(); }
+		void swap( std::vector<Node> &other ) { Own(); owned.swap( other ); Sync(); }
+
+		// Uses the "n" nodes at "nodes", inside the mapping of "mapped".
+		void Map( const std::shared_ptr<MappedFile> &mapped, const Node *nodes, size_t n )
+		{
+			owned.clear();
+			file  = mapped;
+			data  = nodes;
+			count = n;
+		}
+		bool Mapped() const { return file.get() != NULL; }
+
+	private:
+		std::vector<Node>           owned;	// The nodes, unless they are mapped.
+		std::shared_ptr<MappedFile> file;	// The cache file they are read from, if they are.
+		const Node                 *data;	// The first node, wherever it is.
+		size_t                      count;
+
+		void Own()
+		{
+			if( !file ) return;
+			owned.assign( data, data + count );
+			file.reset();
+			Sync();
+		}
+		void Sync() { data = owned.empty() ? NULL : &owned[0]; count = owned.size(); }
+};
+
+class CacheHeader // First bytes of a cache file.
+{
+	public:
+		char               magic[8];	// Identifies the file and the version of its format.
+		char               name[8];		// Name of the accelerator that wrote it.
+		unsigned long long key;			// SceneHash of the objects it was built over.
+		int                node_size;	// sizeof of a node, which guards against a different layout.
+		int                num_nodes;
+		int                num_objects;
+		int                reserved;
+};
+
+bool WriteCache( const char *file_name, const char *name, unsigned long long key, int node_size,
+				 const void *nodes, int num_nodes, const std::vector<Object*> &objects, Object *first );
+
+// Maps the file and checks that it was written by "name" over objects with
+// the given key.  Returns a pointer to the nodes inside the mapping, or NULL
+// if the file cannot be used, and fills "objects" from the list of the scene.
+const char *ReadCache( const MappedFile &file, const char *name, unsigned long long key, int node_size,
+					   int &num_nodes, std::vector<Object*> &objects, Object *first );
+
+// Writes the nodes of a structure, and loads them back, left in the mapping.
+template <class Node>
+bool SaveNodes( const char *file_name, const char *name, unsigned long long key,
+				const NodeArray<Node> &nodes, const std::vector<Object*> &objects, Object *first )
+{
+	if( nodes.empty() ) return false;
+	return WriteCache( file_name, name, key, (int)sizeof( Node ), &nodes[0], (int)nodes.size(), objects, first );
+}
+
+template <class Node>
+bool LoadNodes( const char *file_name, const char *name, unsigned long long key,
+				NodeArray<Node> &nodes, std::vector<Object*> &objects, Object *first )
+{
+	std::shared_ptr<MappedFile> file( new MappedFile( file_name ) );
+	int num_nodes;
+
+	const char *data = ReadCache( *file, name, key, (int)sizeof( Node ), num_nodes, objects, first );
+	if( data == NULL ) return false;
+
+	// The nodes follow the header, which keeps them aligned to 8 bytes.
+	nodes.Map( file, (const Node *)data, num_nodes );
+	return true;
+}
+
+#endif
\ No newline at end of file
@@ -10,9 +10,9 @@ Color::Color()
 
 Color::Color( double r, double g, double b )
 {
-	red = r;
-	green = g; 
-	blue = b; 
+	red = Scalar( r );
+	green = Scalar( g ); 
+	blue = Scalar( b ); 
 }
 
 Color Color::operator+( const Color &c ) const
@@ -47,16 +47,16 @@ void Color::operator+=( const Color &B )
 
 void Color::operator*=( double c )
 {
-	this->red   *= c;
-	this->green *= c;
-	this->blue  *= c;
+	this->red   = Scalar( this->red   * c );
+	this->green = Scalar( this->green * c );
+	this->blue  = Scalar( this->blue  * c );
 }
 
 void Color::operator/=( double c )
 {
-	this->red   /= c;
-	this->green /= c;
-	this->blue  /= c;
+	this->red   = Scalar( this->red   / c );
+	this->green = Scalar( this->green / c );
+	this->blue  = Scalar( this->blue  / c );
 }
 
 ostream &Color::operator<<( ostream &out )
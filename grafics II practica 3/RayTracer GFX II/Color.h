@@ -11,14 +11,16 @@
 
 #include <iostream>
 
+#include "Scalar.h"
+
 using namespace std;
 
 class Color
 {
 	public:
-		double red;
-		double green;
-		double blue;
+		Scalar red;		// In the precision chosen in Scalar.h.
+		Scalar green;
+		Scalar blue;
 	public:
 		
 		Color();
@@ -0,0 +1,19 @@
+@echo off
+rem Renders every scene named on the command line, or every .sdf file in this
+rem folder, with the Release (double) and Release Float builds, and reports for
+rem each one the speedup of the float build and the RMSE between the two images.
+rem Both configurations must have been built first.
+setlocal
+set DOUBLE_EXE="..\Release\RayTracer GFX II.exe"
+set FLOAT_EXE="..\Release Float\RayTracer GFX II.exe"
+set SCENES=%*
+if "%SCENES%"=="" set SCENES=*.sdf
+
+for %%s in (%SCENES%) do (
+	echo %%s
+	%DOUBLE_EXE% "%%s" -nocache -render > nul
+	copy /y Resultat.ppm double.ppm > nul
+	copy /y Resultat.json double.json > nul
+	%FLOAT_EXE% "%%s" -nocache -compare double | findstr /b "Speedup"
+)
+del double.ppm double.json
@@ -0,0 +1,366 @@
+#include <chrono>
+#include <string.h>
+#include <emmintrin.h>
+
+#include "CompressedBVH.h"
+#include "Cache.h"
+
+static const int    StackSize     = 64 * 8;	// Depth of the binary tree times the children pushed per level
+
+// 2^e as a float, built from its bits.
+static inline float Power2( int e )
+{
+	unsigned int bits = (unsigned int)( e + 127 ) << 23;
+	float f;
+	memcpy( &f, &bits, sizeof( f ) );
+	return f;
+}
+
+// Box of child i of the node, decoded from the grid.
+static Box3 ChildBox( const CompressedNode &node, int i )
+{
+	Box3 box;
+	for( int a = 0; a < 3; a++ )
+	{
+		double step = Power2( node.exponent[a] );
+		Along( box, a ).min = Scalar( node.origin[a] + node.lo[a][i] * step );
+		Along( box, a ).max = Scalar( node.origin[a] + node.hi[a][i] * step );
+	}
+	return box;
+}
+
+// Box that contains all the children of the node.
+static Box3 NodeBox( const CompressedNode &node )
+{
+	Box3 box = EmptyBox();
+	for( int i = 0; i < 8; i++ )
+		if( node.count[i] >= 0 ) box = Union( box, ChildBox( node, i ) );
+	return box;
+}
+
+// Chooses the grid of the node so that it covers the boxes of the used
+// children with 255 steps per axis, and snaps every box outwards to it.
+// The snapped planes are checked in float arithmetic, which is the one the
+// traversal uses, and the step is doubled if the rounding pushes a plane
+// out of the 8-bit range.
+static void Quantize( CompressedNode &node, const Box3 box[8] )
+{
+	Box3 frame = EmptyBox();
+	for( int i = 0; i < 8; i++ )
+		if( node.count[i] >= 0 ) frame = Union( frame, box[i] );
+
+	for( int a = 0; a < 3; a++ )
+	{
+		float  origin = RoundDown( Along( frame, a ).min );
+		double extent = RoundUp( Along( frame, a ).max ) - origin;
+		int    e = extent > 0.0 ? (int)ceil( log( extent / 255.0 ) / log( 2.0 ) ) : -100;
+		if( e < -100 ) e = -100;
+
+		for( ;; e++ )
+		{
+			float step = Power2( e );
+			bool  fits = true;
+
+			for( int i = 0; i < 8 && fits; i++ )
+			{
+				if( node.count[i] < 0 )
+				{
+					// Unused slot, an empty box that no ray can hit.
+					node.lo[a][i] = 255;
+					node.hi[a][i] = 0;
+					continue;
+				}
+				float lo = RoundDown( Along( box[i], a ).min );
+				float hi = RoundUp( Along( box[i], a ).max );
+
+				int qlo = (int)floor( ( lo - origin ) / step );
+				if( qlo < 0 ) qlo = 0;
+				while( qlo > 0 && origin + qlo * step > lo ) qlo--;
+
+				int qhi = (int)ceil( ( hi - origin ) / step );
+				while( origin + qhi * step < hi ) qhi++;
+
+				if( qhi > 255 ) fits = false;
+				node.lo[a][i] = (unsigned char)qlo;
+				node.hi[a][i] = (unsigned char)qhi;
+			}
+			if( fits ) break;
+		}
+		node.origin[a]   = origin;
+		node.exponent[a] = (signed char)e;
+	}
+	node.padding = 0;
+}
+
+void CompressedBVH::Build( Object *first )
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	OBVH wide;
+
+	nodes.clear();
+	objects.clear();
+
+	wide.Build( first );
+	if( wide.NumNodes() == 0 ) return;
+
+	objects.resize( wide.NumObjects() );
+	for( int i = 0; i < wide.NumObjects(); i++ ) objects[i] = wide.GetObject( i );
+	primitives.Compile( objects );
+
+	// Same tree as the wide BVH, with its float boxes snapped to the grids.
+	nodes.resize( wide.NumNodes() );
+	for( int n = 0; n < wide.NumNodes(); n++ )
+	{
+		const WideNode<8> &w = wide.GetNode( n );
+		Box3 box[8];
+		for( int i = 0; i < 8; i++ )
+		{
+			nodes[n].child[i] = w.child[i];
+			nodes[n].count[i] = (short)w.count[i];
+			box[i].X.min = w.box[0][i];  box[i].X.max = w.box[1][i];
+			box[i].Y.min = w.box[2][i];  box[i].Y.max = w.box[3][i];
+			box[i].Z.min = w.box[4][i];  box[i].Z.max = w.box[5][i];
+		}
+		Quantize( nodes[n], box );
+	}
+
+	build_time = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+	build_cost = Cost();
+}
+
+// Converts four 8-bit plane coordinates to floats.
+static inline __m128 LoadPlanes( const unsigned char *q )
+{
+	int bytes;
+	memcpy( &bytes, q, sizeof( bytes ) );
+	__m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( bytes ), zero ), zero );
+	return _mm_cvtepi32_ps( v );
+}
+
+// Slab test of one ray against the eight children of the node, four at a
+// time.  On each axis, the distance to a plane at grid coordinate q is
+// q * ( step / d ) + ( origin - o ) / d, so the boxes are never decoded.
+// Returns a bit mask of the children hit and their entry distances.
+static inline int HitChildren( const CompressedNode &node, const WideRay &ray, float tmax, float *tnear )
+{
+	__m128 scale[3], offset[3];
+	int mask = 0;
+
+	for( int a = 0; a < 3; a++ )
+	{
+		scale[a]  = _mm_set1_ps( Power2( node.exponent[a] ) * ray.inv_dir[a] );
+		offset[a] = _mm_set1_ps( ( node.origin[a] - ray.origin[a] ) * ray.inv_dir[a] );
+	}
+
+	for( int half = 0; half < 8; half += 4 )
+	{
+		__m128 tn = _mm_setzero_ps();
+		__m128 tf = _mm_set1_ps( tmax );
+
+		for( int a = 0; a < 3; a++ )
+		{
+			// Entry plane is the minimum for positive directions, the maximum otherwise.
+			const unsigned char *near_plane = ray.inv_dir[a] < 0.0f ? node.hi[a] : node.lo[a];
+			const unsigned char *far_plane  = ray.inv_dir[a] < 0.0f ? node.lo[a] : node.hi[a];
+			tn = _mm_max_ps( tn, _mm_add_ps( _mm_mul_ps( LoadPlanes( near_plane + half ), scale[a] ), offset[a] ) );
+			tf = _mm_min_ps( tf, _mm_add_ps( _mm_mul_ps( LoadPlanes( far_plane  + half ), scale[a] ), offset[a] ) );
+		}
+
+		// A few ulps of slack on the exit distance absorb the rounding of the products.
+		tf = _mm_mul_ps( tf, _mm_set1_ps( 1.0000005f ) );
+
+		_mm_storeu_ps( tnear + half, tn );
+		mask |= _mm_movemask_ps( _mm_cmple_ps( tn, tf ) ) << half;
+	}
+	return mask;
+}
+
+const Object *CompressedBVH::Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore ) const
+{
+	QueryCount work;
+	const Object *hit = NULL;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( nodes.empty() ) return NULL;
+
+	WideRay r( ray );
+
+	for(;;)
+	{
+		const CompressedNode &node = nodes[current];
+		work.nodes++;
+		float tnear[8];
+		int   inner[8];
+		int   num_inner = 0;
+
+		int mask = HitChildren( node, r, RoundUp( hitgeom.distance ), tnear );
+
+		for( int i = 0; i < 8; i++ )
+		{
+			if( ( mask & ( 1 << i ) ) == 0 || node.count[i] < 0 ) continue;
+
+			if( node.count[i] > 0 )
+			{
+				for( int j = node.child[i]; j < node.child[i] + node.count[i]; j++ )
+				{
+					work.primitives++;
+					const Object *object = primitives.Hit( j, ray, hitgeom, ignore );
+					if( object != NULL ) hit = object;
+				}
+			}
+			else
+			{
+				// Nearest inner child last, so that it is popped first.
+				int k = num_inner++;
+				while( k > 0 && tnear[inner[k - 1]] < tnear[i] )
+				{
+					inner[k] = inner[k - 1];
+					k--;
+				}
+				inner[k] = i;
+			}
+		}
+
+		for( int k = 0; k < num_inner; k++ )
+		{
+			if( tnear[inner[k]] <= hitgeom.distance ) stack[sp++] = node.child[inner[k]];
+		}
+
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return hit;
+}
+
+bool CompressedBVH::Occluded( const Ray &ray, double max_distance, const Object *ignore ) const
+{
+	QueryCount work;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( nodes.empty() ) return false;
+
+	WideRay r( ray );
+	float tmax = RoundUp( max_distance );
+
+	for(;;)
+	{
+		const CompressedNode &node = nodes[current];
+		work.nodes++;
+		float tnear[8];
+
+		int mask = HitChildren( node, r, tmax, tnear );
+		for( int i = 0; i < 8; i++ )
+		{
+			if( ( mask & ( 1 << i ) ) == 0 || node.count[i] < 0 ) continue;
+
+			if( node.count[i] > 0 )
+			{
+				for( int j = node.child[i]; j < node.child[i] + node.count[i]; j++ )
+				{
+					work.primitives++;
+					if( primitives.Occludes( j, ray, max_distance, ignore ) ) return true;
+				}
+			}
+			else stack[sp++] = node.child[i];
+		}
+
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return false;
+}
+
+// Children are stored after their parents, so walking the nodes backwards
+// snaps the children of a node to their new grids before the node itself.
+void CompressedBVH::Refit()
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	for( int n = NumNodes() - 1; n >= 0; n-- )
+	{
+		CompressedNode &node = nodes[n];
+		Box3 box[8];
+		for( int i = 0; i < 8; i++ )
+		{
+			box[i] = EmptyBox();
+			if( node.count[i] > 0 )
+			{
+				for( int j = node.child[i]; j < node.child[i] + node.count[i]; j++ )
+					box[i] = Union( box[i], objects[j]->GetBounds() );
+			}
+			else if( node.count[i] == 0 ) box[i] = NodeBox( nodes[node.child[i]] );
+		}
+		Quantize( node, box );
+	}
+	primitives.Compile( objects );
+
+	refit_time = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+}
+
+// Same measure as BVH::Cost, over the decoded boxes.
+double CompressedBVH::Cost() const
+{
+	double object_area = 0.0;
+
+	if( nodes.empty() ) return 0.0;
+
+	double cost = TraversalCost * SurfaceArea( NodeBox( nodes[0] ) );
+	for( int n = 0; n < NumNodes(); n++ )
+	{
+		for( int i = 0; i < 8; i++ )
+		{
+			int count = nodes[n].count[i];
+			if( count < 0 ) continue;
+			double work = count > 0 ? IntersectCost * count : TraversalCost;
+			cost += SurfaceArea( ChildBox( nodes[n], i ) ) * work;
+		}
+	}
+	for( size_t i = 0; i < objects.size(); i++ ) object_area += SurfaceArea( objects[i]->GetBounds() );
+	return object_area > 0.0 ? cost / object_area : cost;
+}
+
+void CompressedBVH::GetTreeStats( TreeStats &stats ) const
+{
+	std::vector< std::pair<int, int> > stack;	// Nodes left to visit, with their depth.
+
+	if( !nodes.empty() ) stack.push_back( std::make_pair( 0, 0 ) );
+	while( !stack.empty() )
+	{
+		const CompressedNode &node = nodes[stack.back().first];
+		int depth = stack.back().second;
+		stack.pop_back();
+
+		for( int i = 0; i < 8; i++ )
+		{
+			if( node.count[i] > 0 ) stats.AddLeaf( node.count[i], depth + 1 );
+			else if( node.count[i] == 0 ) stack.push_back( std::make_pair( node.child[i], depth + 1 ) );
+		}
+	}
+}
+
+bool CompressedBVH::Save( const char *file_name, unsigned long long key, Object *first ) const
+{
+	return SaveNodes( file_name, Name(), key, nodes, objects, first );
+}
+
+bool CompressedBVH::Load( const char *file_name, unsigned long long key, Object *first )
+{
+	if( !LoadNodes( file_name, Name(), key, nodes, objects, first ) ) return false;
+
+	primitives.Compile( objects );
+	build_cost = Cost();
+	return true;
+}
+
+void CompressedBVH::Report( ostream &out ) const
+{
+	out << "Compressed 8-wide BVH built in " << build_time * 1000.0 << " ms: "
+		<< NumNodes() << " nodes of " << sizeof( CompressedNode ) << " bytes ("
+		<< NumNodes() * sizeof( CompressedNode ) / 1024 << " KB) over " << objects.size() << " objects, SAH cost "
+		<< build_cost << "." << endl;
+}
\ No newline at end of file
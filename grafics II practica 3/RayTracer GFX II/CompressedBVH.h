@@ -0,0 +1,61 @@
+#ifndef COMPRESSEDBVH_H
+#define COMPRESSEDBVH_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines a compressed 8-wide bounding volume hierarchy.  It has *
+* the same tree as the 8-wide BVH, but instead of six floats per child     *
+* every node stores a local grid: a corner and, on each axis, a step that  *
+* is a power of two.  The bounds of the children are snapped outwards to   *
+* that grid and kept as 8-bit coordinates, which shrinks a node from 256   *
+* to 112 bytes, so that much larger hierarchies stay in the caches.        *
+*                                                                          *
+* The boxes are never decoded during traversal.  The ray is moved into     *
+* the grid of the node instead, and the distance to a plane is computed    *
+* from its 8-bit coordinate with a single multiply and add.                *
+*                                                                          *
+***************************************************************************/
+
+#include <vector>
+
+#include "WideBVH.h"
+
+class CompressedNode // A node with up to 8 children and quantized bounds.
+{
+	public:
+		float         origin[3];	// Corner of the grid the bounds of the children are snapped to.
+		signed char   exponent[3];	// The step of the grid along each axis is 2^exponent.
+		unsigned char padding;
+		unsigned char lo[3][8];		// Child bounds, in steps from the corner: X, Y and Z minimums...
+		unsigned char hi[3][8];		// ...and maximums.
+		int           child[8];		// Leaf child: index of its first object. Inner child: index of its node.
+		short         count[8];		// Objects in a leaf child, 0 for an inner child, -1 for an unused slot.
+};
+
+class CompressedBVH : public Accelerator
+{
+	public:
+		CompressedBVH() {}
+		virtual ~CompressedBVH() {}
+
+		void Build( Object *first );
+		const Object *Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore = NULL ) const;
+		bool Occluded( const Ray &ray, double max_distance, const Object *ignore = NULL ) const;
+		void Refit();
+		double Cost() const;
+		bool Cacheable() const { return true; }
+		bool Save( const char *file_name, unsigned long long key, Object *first ) const;
+		bool Load( const char *file_name, unsigned long long key, Object *first );
+		const char *Name() const { return "cbvh"; }
+		void Report( ostream &out ) const;
+		void GetTreeStats( TreeStats &stats ) const;
+
+		int NumNodes() const { return (int)nodes.size(); }
+
+	private:
+		NodeArray<CompressedNode> nodes;
+		std::vector<Object*>        objects;
+		Primitives                  primitives;	// The objects compiled, which the leaves test.
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,46 @@
+#include "Cpu.h"
+
+#if defined( _MSC_VER )
+	#include <intrin.h>
+#else
+	#include <cpuid.h>
+#endif
+
+static void CpuId( int leaf, int sub, unsigned int regs[4] )
+{
+#if defined( _MSC_VER )
+	int info[4];
+	__cpuidex( info, leaf, sub );
+	for( int i = 0; i < 4; i++ ) regs[i] = (unsigned int)info[i];
+#else
+	__cpuid_count( leaf, sub, regs[0], regs[1], regs[2], regs[3] );
+#endif
+}
+
+// Register state enabled by the operating system (XCR0).
+static unsigned long long XGetBV()
+{
+#if defined( _MSC_VER )
+	return _xgetbv( 0 );
+#else
+	unsigned int lo, hi;
+	__asm__ __volatile__( "xgetbv" : "=a"( lo ), "=d"( hi ) : "c"( 0 ) );
+	return ( (unsigned long long)hi << 32 ) | lo;
+#endif
+}
+
+bool CpuHasAVX()
+{
+	static int has_avx = -1;	// Computed on the first call.
+
+	if( has_avx < 0 )
+	{
+		unsigned int regs[4];
+		CpuId( 1, 0, regs );
+		bool avx     = ( regs[2] & ( 1u << 28 ) ) != 0;
+		bool osxsave = ( regs[2] & ( 1u << 27 ) ) != 0;
+		// The OS must also save the YMM registers on context switches.
+		has_avx = ( avx && osxsave && ( XGetBV() & 6 ) == 6 ) ? 1 : 0;
+	}
+	return has_avx == 1;
+}
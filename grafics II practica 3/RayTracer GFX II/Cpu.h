@@ -0,0 +1,21 @@
+#ifndef CPU_H
+#define CPU_H
+
+/***************************************************************************
+*                                                                          *
+* Run-time detection of the vector instruction sets of the processor.      *
+* Functions that use AVX intrinsics are marked with TARGET_AVX so that     *
+* compilers that need it (GCC, Clang) generate AVX code for them only;     *
+* they must not be called unless CpuHasAVX() returns true.                 *
+*                                                                          *
+***************************************************************************/
+
+#if defined( __GNUC__ )
+	#define TARGET_AVX  __attribute__(( target( "avx" ) ))
+#else
+	#define TARGET_AVX
+#endif
+
+bool CpuHasAVX();	// The processor and the operating system support AVX.
+
+#endif
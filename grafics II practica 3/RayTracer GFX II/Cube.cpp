@@ -23,77 +23,89 @@ Box3 Cube::GetBounds() const // Returns a bounding box (which is just the box it
     return box;
 }
 
+// Distances along the ray to the planes of the box on one axis, the
+// nearer one in "enter".
+static inline void Slab( double lo, double hi, double origin, double inv_dir, double &enter, double &leave )
+{
+	double t0 = ( lo - origin ) * inv_dir;
+	double t1 = ( hi - origin ) * inv_dir;
+	enter = t0 < t1 ? t0 : t1;
+	leave = t0 < t1 ? t1 : t0;
+}
+
 bool Cube::Intersect( const Ray &ray, HitGeom &hitgeom ) const
-{	
-
-	Plane plans [6] = {Plane(1,0,0,-Max.x),
-		Plane(0,1,0,-Max.y),
-		Plane(0,0,1,-Max.z),
-		Plane(-1,0,0,Min.x),
-		Plane(0,-1,0,Min.y),
-		Plane(0,0,-1,Min.z)
-	};
-
-	bool bInterseccio = false;
-	int i;
-	double raigIntersec;
-	Vec3 posicio;
-	bool dins;
-
-	for (i = 0; i < 6 ; i++)
-	{
-		raigIntersec = plans[i].Intersect(ray);
-
-		if( raigIntersec > 0.0 && raigIntersec < hitgeom.distance)
-		{
-
-			posicio = ray.origin + (ray.direction * raigIntersec);
-
-			dins = false;
-			switch (i)
-			{
-				case 0:
-					if(posicio.y > Min.y && posicio.y < Max.y && posicio.z > Min.z && posicio.z < Max.z)
-						dins = true;
-					break;
-				case 1:
-					if(posicio.x > Min.x && posicio.x < Max.x && posicio.z > Min.z && posicio.z < Max.z)
-						dins = true;
-					break;
-				case 2:
-					if(posicio.y > Min.y && posicio.y < Max.y && posicio.x > Min.x && posicio.x < Max.x)
-						dins = true;
-					break;
-				case 3:
-					if(posicio.y > Min.y && posicio.y < Max.y && posicio.z > Min.z && posicio.z < Max.z)
-						dins = true;
-					break;
-				case 4:
-					if(posicio.x > Min.x && posicio.x < Max.x && posicio.z > Min.z && posicio.z < Max.z)
-						dins = true;
-					break;
-				case 5:
-					if(posicio.y > Min.y && posicio.y < Max.y && posicio.x > Min.x && posicio.x < Max.x)
-						dins = true;
-					break;
-			}
-
-			if (dins)
-			{
-			//	if((ray.direction * plans[i].getNormal()) < 0.0)
-				{
-					hitgeom.distance = raigIntersec;
-					hitgeom.normal = plans[i].getNormal();
-					hitgeom.origin = ray.origin;
-					hitgeom.point = posicio;
-					bInterseccio = true;
-				}
-			}
-
-		}
-	}
-	
-	return bInterseccio;
+{
+	if( Hit( ray, hitgeom ) == NULL ) return false;
+	GetHitAttributes( ray, hitgeom );
+	return true;
+}
+
+const Object *Cube::Hit( const Ray &ray, HitGeom &hitgeom ) const
+{
+	double t;
+	int face;
+	if( !HitCube( ray, Min, Max, hitgeom.distance, t, face ) ) return NULL;
+	hitgeom.distance = Scalar( t );
+	hitgeom.part     = face;
+	hitgeom.object   = this;
+	return this;
+}
+
+void Cube::GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const
+{
+	int axis = hitgeom.part >> 1;
+	double sign = ( hitgeom.part & 1 ) ? 1.0 : -1.0;
+	hitgeom.normal = Vec3( axis == 0 ? sign : 0.0, axis == 1 ? sign : 0.0, axis == 2 ? sign : 0.0 );
+	hitgeom.origin = ray.origin;
+	hitgeom.point  = ray.origin + hitgeom.distance * ray.direction;
+}
+
+bool Cube::Occludes( const Ray &ray, double max_distance ) const
+{
+	return OccludesCube( ray, Min, Max, max_distance );
+}
+
+bool HitCube( const Ray &ray, const Vec3 &Min, const Vec3 &Max, double max_distance, double &t, int &face )
+{
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+	double enter[3], leave[3];
+
+	Slab( Min.x, Max.x, ray.origin.x, inv_dir.x, enter[0], leave[0] );
+	Slab( Min.y, Max.y, ray.origin.y, inv_dir.y, enter[1], leave[1] );
+	Slab( Min.z, Max.z, ray.origin.z, inv_dir.z, enter[2], leave[2] );
+
+	// Axis of the last entry and of the first exit.
+	int in  = enter[0] > enter[1] ? ( enter[0] > enter[2] ? 0 : 2 ) : ( enter[1] > enter[2] ? 1 : 2 );
+	int out = leave[0] < leave[1] ? ( leave[0] < leave[2] ? 0 : 2 ) : ( leave[1] < leave[2] ? 1 : 2 );
+	double t_in  = enter[in];
+	double t_out = leave[out];
+	if( t_in > t_out ) return false;
+
+	// A ray that starts inside the box hits it where it leaves.
+	bool inside = t_in <= 0.0;
+	t = inside ? t_out : t_in;
+	int axis = inside ? out : in;
+	if( t <= 0.0 || t >= max_distance ) return false;
+
+	// The face faces against the ray where it enters, and along it where it leaves.
+	double d = Component( ray.direction, axis );
+	face = 2 * axis + ( ( d < 0.0 ) == inside ? 0 : 1 );
+	return true;
+}
+
+bool OccludesCube( const Ray &ray, const Vec3 &Min, const Vec3 &Max, double max_distance )
+{
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+	double enter[3], leave[3];
+
+	Slab( Min.x, Max.x, ray.origin.x, inv_dir.x, enter[0], leave[0] );
+	Slab( Min.y, Max.y, ray.origin.y, inv_dir.y, enter[1], leave[1] );
+	Slab( Min.z, Max.z, ray.origin.z, inv_dir.z, enter[2], leave[2] );
+
+	double t_in  = enter[0] > enter[1] ? ( enter[0] > enter[2] ? enter[0] : enter[2] ) : ( enter[1] > enter[2] ? enter[1] : enter[2] );
+	double t_out = leave[0] < leave[1] ? ( leave[0] < leave[2] ? leave[0] : leave[2] ) : ( leave[1] < leave[2] ? leave[1] : leave[2] );
+	double t = t_in > 0.0 ? t_in : t_out;
+	return t_in <= t_out && t > 0.0 && t < max_distance;
 }
 
 Sample Cube::GetSample( const Vec3 &P, const Vec3 &N ) const
@@ -124,10 +136,10 @@ Sample Cube::GetSample( const Vec3 &P, const Vec3 &N ) const
 	// Calcule the distance between the sample and the point P
 	d = Length( sample.P - P );
 	// Assigns the weight
-	sample.w = projected_area / ( d * d );
+	sample.w = Scalar( projected_area / ( d * d ) );
 	// Limit weight to twopi
 	if (sample.w > TwoPi)
-		sample.w = TwoPi;
+		sample.w = Scalar( TwoPi );
 
 	return sample;
 }
\ No newline at end of file
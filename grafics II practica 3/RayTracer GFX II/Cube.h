@@ -1,8 +1,13 @@
 #ifndef CUBE_H
 #define CUBE_H
 
+// An axis-aligned box.  Rays are intersected with it by the slab test:
+// along each axis the ray is inside the box between the distances where
+// it crosses the two planes of that axis, so it is inside the box between
+// the largest of the three entry distances and the smallest of the three
+// exit distances.  The axis of the last entry is the face that was hit.
+
 #include "Object.h"
-#include "Plane.h"
 class Cube : public Object 
 {
 	public:
@@ -11,6 +16,9 @@ class Cube : public Object
 
 		Cube( const Vec3 &Min, const Vec3 &Max );
 		bool Intersect( const Ray &ray, HitGeom &hitgeom ) const;
+		bool Occludes( const Ray &ray, double max_distance ) const;
+		const Object *Hit( const Ray &ray, HitGeom &hitgeom ) const;
+		void GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const;
 
 		Sample GetSample( const Vec3 &P, const Vec3 &N ) const;
 
@@ -19,4 +27,12 @@ class Cube : public Object
 
 };
 
+// The slab test on the corners of a box, as used by Cube, so that the
+// primitive arrays of the accelerators can use it too (see Primitives.h).
+// HitCube returns true if the ray hits the box at a distance between 0 and
+// max_distance, which is left in "t", and the face hit in "face": twice its
+// axis, plus one if its normal points along the axis.
+bool HitCube( const Ray &ray, const Vec3 &Min, const Vec3 &Max, double max_distance, double &t, int &face );
+bool OccludesCube( const Ray &ray, const Vec3 &Min, const Vec3 &Max, double max_distance );
+
 #endif
\ No newline at end of file
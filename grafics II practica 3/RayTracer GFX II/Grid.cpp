@@ -0,0 +1,365 @@
+#include <chrono>
+#include <math.h>
+
+#include "Grid.h"
+
+static const double Density       = 4.0;	// Cells per object of a single grid and of the refining grids
+static const double TopDensity    = 1.0;	// Cells per object of the coarse grid of a two level grid
+static const int    SubgridSize   = 8;		// Cells with more objects than this are refined
+static const int    MaxResolution = 512;	// Cells along any axis
+
+// Cells along each axis: about "density" cells per object, as close to
+// cubes as possible.  Flat boxes get a single cell across their thin axes.
+static void ChooseResolution( const Box3 &box, int count, double density, int res[3] )
+{
+	double size = 1.0;
+	int    dims = 0;
+
+	for( int a = 0; a < 3; a++ )
+	{
+		double extent = Along( box, a ).max - Along( box, a ).min;
+		if( extent > 0.0 ) { size *= extent; dims++; }
+	}
+
+	double cells_per_unit = dims > 0 ? pow( density * count / size, 1.0 / dims ) : 0.0;
+	for( int a = 0; a < 3; a++ )
+	{
+		double extent = Along( box, a ).max - Along( box, a ).min;
+		int r = (int)( extent * cells_per_unit + 0.5 );
+		res[a] = r < 1 ? 1 : ( r > MaxResolution ? MaxResolution : r );
+	}
+}
+
+// Cell of the level that contains coordinate v along the axis, clamped to the grid.
+static inline int CellCoord( const GridLevel &level, int axis, double v )
+{
+	double size = Component( level.cell_size, axis );
+	if( size <= 0.0 ) return 0;
+
+	int c = (int)floor( ( v - Along( level.box, axis ).min ) / size );
+	return c < 0 ? 0 : ( c >= level.res[axis] ? level.res[axis] - 1 : c );
+}
+
+// Fills the cells of the level with the objects whose bounds overlap them.
+// The objects are counted first, so that every cell gets its slice of a
+// single array.
+static void BuildLevel( GridLevel &level, const std::vector<Object*> &objects, const std::vector<Box3> &bounds,
+						const Box3 &box, double density )
+{
+	int lo[3], hi[3];
+
+	level.box = box;
+	ChooseResolution( box, (int)objects.size(), density, level.res );
+	level.cell_size = Vec3( ( box.X.max - box.X.min ) / level.res[0],
+							( box.Y.max - box.Y.min ) / level.res[1],
+							( box.Z.max - box.Z.min ) / level.res[2] );
+	level.start.assign( level.NumCells() + 1, 0 );
+
+	for( int pass = 0; pass < 2; pass++ )
+	{
+		std::vector<int> next;
+		if( pass == 1 )
+		{
+			// Turn the counts into the first index of every cell.
+			for( int c = 0; c < level.NumCells(); c++ ) level.start[c + 1] += level.start[c];
+			level.refs.resize( level.start[level.NumCells()] );
+			next.assign( level.start.begin(), level.start.end() - 1 );
+		}
+
+		for( size_t i = 0; i < objects.size(); i++ )
+		{
+			for( int a = 0; a < 3; a++ )
+			{
+				lo[a] = CellCoord( level, a, Along( bounds[i], a ).min );
+				hi[a] = CellCoord( level, a, Along( bounds[i], a ).max );
+			}
+			for( int z = lo[2]; z <= hi[2]; z++ )
+			for( int y = lo[1]; y <= hi[1]; y++ )
+			for( int x = lo[0]; x <= hi[0]; x++ )
+			{
+				int c = ( z * level.res[1] + y ) * level.res[0] + x;
+				if( pass == 0 ) level.start[c + 1]++;
+				else level.refs[next[c]++] = objects[i];
+			}
+		}
+	}
+	level.primitives.Compile( level.refs );
+}
+
+void Grid::Build( Object *first )
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	std::vector<Object*> objects;
+	std::vector<Box3>    bounds;
+	Box3 box = EmptyBox();
+
+	first_object = first;
+	top = GridLevel();
+	subgrids.clear();
+
+	for( Object *object = first; object != NULL; object = object->next )
+	{
+		objects.push_back( object );
+		bounds.push_back( object->GetBounds() );
+		box = Union( box, bounds.back() );
+	}
+	if( objects.empty() ) return;
+
+	BuildLevel( top, objects, bounds, box, two_levels ? TopDensity : Density );
+
+	if( two_levels )
+	{
+		top.subgrid.assign( top.NumCells(), -1 );
+		for( int c = 0; c < top.NumCells(); c++ )
+		{
+			if( top.start[c + 1] - top.start[c] <= SubgridSize ) continue;
+
+			// Refine the cell with a grid over the part of its objects inside it.
+			std::vector<Object*> cell_objects( top.refs.begin() + top.start[c], top.refs.begin() + top.start[c + 1] );
+			std::vector<Box3>    cell_bounds;
+			Box3 used = EmptyBox();
+			for( size_t i = 0; i < cell_objects.size(); i++ )
+			{
+				cell_bounds.push_back( cell_objects[i]->GetBounds() );
+				used = Union( used, cell_bounds.back() );
+			}
+
+			int x = c % top.res[0];
+			int y = ( c / top.res[0] ) % top.res[1];
+			int z = c / ( top.res[0] * top.res[1] );
+			Box3 cell;
+			cell.X.min = top.box.X.min + x * top.cell_size.x;  cell.X.max = cell.X.min + top.cell_size.x;
+			cell.Y.min = top.box.Y.min + y * top.cell_size.y;  cell.Y.max = cell.Y.min + top.cell_size.y;
+			cell.Z.min = top.box.Z.min + z * top.cell_size.z;  cell.Z.max = cell.Z.min + top.cell_size.z;
+
+			top.subgrid[c] = (int)subgrids.size();
+			subgrids.push_back( GridLevel() );
+			BuildLevel( subgrids.back(), cell_objects, cell_bounds, Intersection( cell, used ), Density );
+		}
+	}
+
+	build_time = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+	build_cost = Cost();
+}
+
+// 3D-DDA: calls visit( cell, t_enter, t_exit ) for the cells of the level
+// crossed by the ray between t_min and t_max, in order, until it returns
+// true.
+template <class Visitor>
+void Grid::Walk( const GridLevel &level, const Ray &ray, const Vec3 &inv_dir, double t_min, double t_max, Visitor &visit ) const
+{
+	double t0 = t_min;
+	double t1 = t_max;
+
+	// Clip the ray to the box of the grid.
+	for( int a = 0; a < 3; a++ )
+	{
+		double o   = Component( ray.origin, a );
+		double inv = Component( inv_dir, a );
+		double ta  = ( Along( level.box, a ).min - o ) * inv;
+		double tb  = ( Along( level.box, a ).max - o ) * inv;
+		if( ta > tb ) { double t = ta; ta = tb; tb = t; }
+		if( ta > t0 ) t0 = ta;
+		if( tb < t1 ) t1 = tb;
+	}
+	if( t0 > t1 ) return;
+
+	int    cell[3], step[3], stop[3];
+	double t_next[3], t_delta[3];
+	Vec3   P = ray.origin + t0 * ray.direction;
+
+	for( int a = 0; a < 3; a++ )
+	{
+		double size = Component( level.cell_size, a );
+		double o    = Component( ray.origin, a );
+		double inv  = Component( inv_dir, a );
+
+		cell[a] = CellCoord( level, a, Component( P, a ) );
+		if( inv >= 0.0 )
+		{
+			step[a]   = 1;
+			stop[a]   = level.res[a];
+			t_next[a] = ( Along( level.box, a ).min + ( cell[a] + 1 ) * size - o ) * inv;
+		}
+		else
+		{
+			step[a]   = -1;
+			stop[a]   = -1;
+			t_next[a] = ( Along( level.box, a ).min + cell[a] * size - o ) * inv;
+		}
+		t_delta[a] = size * fabs( inv );
+
+		// A flat grid has a single cell across, which the ray never leaves along that axis.
+		if( size <= 0.0 ) t_next[a] = Infinity;
+	}
+
+	double t_enter = t0;
+	for(;;)
+	{
+		int axis = t_next[0] < t_next[1] ? ( t_next[0] < t_next[2] ? 0 : 2 ) : ( t_next[1] < t_next[2] ? 1 : 2 );
+		double t_exit = t_next[axis] < t1 ? t_next[axis] : t1;
+
+		if( visit( ( cell[2] * level.res[1] + cell[1] ) * level.res[0] + cell[0], t_enter, t_exit ) ) return;
+		if( t_next[axis] >= t1 ) return;
+
+		cell[axis] += step[axis];
+		if( cell[axis] == stop[axis] ) return;
+		t_enter = t_next[axis];
+		t_next[axis] += t_delta[axis];
+	}
+}
+
+const Object *Grid::Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore ) const
+{
+	QueryCount work;
+	const Object *hit = NULL;
+
+	if( top.refs.empty() ) return NULL;
+
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+
+	// Tests the objects of a cell.  An object may be hit beyond the cell, so
+	// the walk only stops once the closest hit lies before the cell's end.
+	auto test = [&]( const GridLevel &level, int cell, double t_exit ) -> bool
+	{
+		work.nodes++;
+		for( int i = level.start[cell]; i < level.start[cell + 1]; i++ )
+		{
+			work.primitives++;
+			const Object *object = level.primitives.Hit( i, ray, hitgeom, ignore );
+			if( object != NULL ) hit = object;
+		}
+		return hitgeom.distance <= t_exit;
+	};
+
+	auto visit = [&]( int cell, double t_enter, double t_exit ) -> bool
+	{
+		if( top.subgrid.empty() || top.subgrid[cell] < 0 ) return test( top, cell, t_exit );
+
+		const GridLevel &sub = subgrids[top.subgrid[cell]];
+		auto visit_sub = [&]( int sub_cell, double, double sub_exit ) -> bool
+		{
+			return test( sub, sub_cell, sub_exit );
+		};
+		Walk( sub, ray, inv_dir, t_enter, t_exit, visit_sub );
+		return hitgeom.distance <= t_exit;
+	};
+
+	Walk( top, ray, inv_dir, 0.0, hitgeom.distance, visit );
+	return hit;
+}
+
+bool Grid::Occluded( const Ray &ray, double max_distance, const Object *ignore ) const
+{
+	QueryCount work;
+	bool blocked = false;
+
+	if( top.refs.empty() ) return false;
+
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+
+	auto test = [&]( const GridLevel &level, int cell ) -> bool
+	{
+		work.nodes++;
+		for( int i = level.start[cell]; i < level.start[cell + 1] && !blocked; i++ )
+		{
+			work.primitives++;
+			if( level.primitives.Occludes( i, ray, max_distance, ignore ) ) blocked = true;
+		}
+		return blocked;
+	};
+
+	auto visit = [&]( int cell, double t_enter, double t_exit ) -> bool
+	{
+		if( top.subgrid.empty() || top.subgrid[cell] < 0 ) return test( top, cell );
+
+		const GridLevel &sub = subgrids[top.subgrid[cell]];
+		auto visit_sub = [&]( int sub_cell, double, double ) -> bool
+		{
+			return test( sub, sub_cell );
+		};
+		Walk( sub, ray, inv_dir, t_enter, t_exit, visit_sub );
+		return blocked;
+	};
+
+	Walk( top, ray, inv_dir, 0.0, max_distance, visit );
+	return blocked;
+}
+
+// A grid has no hierarchy of boxes to refit, and building it again only
+// takes linear time.
+void Grid::Refit()
+{
+	double seconds = build_time;
+	Build( first_object );
+	refit_time = build_time;
+	build_time = seconds;
+}
+
+// Area of one cell of the level.
+static double CellArea( const GridLevel &level )
+{
+	const Vec3 &size = level.cell_size;
+	return 2.0 * ( size.x * size.y + size.y * size.z + size.z * size.x );
+}
+
+// Each cell is reached with a probability proportional to its area, and
+// costs a step plus the intersection of its objects, or a step into the
+// grid that refines it.  Divided by the areas of the objects, as BVH::Cost.
+double Grid::Cost() const
+{
+	double cost = 0.0;
+	double object_area = 0.0;
+
+	if( top.refs.empty() ) return 0.0;
+
+	for( int c = 0; c < top.NumCells(); c++ )
+	{
+		if( top.subgrid.empty() || top.subgrid[c] < 0 )
+		{
+			cost += CellArea( top ) * ( TraversalCost + IntersectCost * ( top.start[c + 1] - top.start[c] ) );
+			continue;
+		}
+		const GridLevel &sub = subgrids[top.subgrid[c]];
+		cost += CellArea( top ) * TraversalCost;
+		for( int s = 0; s < sub.NumCells(); s++ )
+			cost += CellArea( sub ) * ( TraversalCost + IntersectCost * ( sub.start[s + 1] - sub.start[s] ) );
+	}
+	for( Object *object = first_object; object != NULL; object = object->next ) object_area += SurfaceArea( object->GetBounds() );
+	return object_area > 0.0 ? cost / object_area : cost;
+}
+
+void Grid::Report( ostream &out ) const
+{
+	int objects = 0;
+	int refs = (int)top.refs.size();
+	int cells = top.NumCells();
+	for( Object *object = first_object; object != NULL; object = object->next ) objects++;
+	for( size_t i = 0; i < subgrids.size(); i++ )
+	{
+		refs  += (int)subgrids[i].refs.size();
+		cells += subgrids[i].NumCells();
+	}
+
+	out << ( two_levels ? "Two level grid" : "Grid" ) << " built in " << build_time * 1000.0 << " ms: "
+		<< top.res[0] << "x" << top.res[1] << "x" << top.res[2] << " cells";
+	if( two_levels ) out << " refined by " << subgrids.size() << " grids, " << cells << " cells in all";
+	out << ", " << refs << " references to " << objects << " objects, cost " << build_cost << "." << endl;
+}
+
+// Every cell is a leaf one level below its grid.  Refined cells are
+// replaced by the cells of their grid, two levels down.
+void Grid::GetTreeStats( TreeStats &stats ) const
+{
+	if( top.refs.empty() ) return;
+	for( int c = 0; c < top.NumCells(); c++ )
+	{
+		if( top.subgrid.empty() || top.subgrid[c] < 0 )
+		{
+			stats.AddLeaf( top.start[c + 1] - top.start[c], 1 );
+			continue;
+		}
+		const GridLevel &sub = subgrids[top.subgrid[c]];
+		for( int s = 0; s < sub.NumCells(); s++ ) stats.AddLeaf( sub.start[s + 1] - sub.start[s], 2 );
+	}
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef GRID_H
+#define GRID_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines a regular grid over the objects of a scene.  The box   *
+* of the scene is divided into cells of the same size, and every cell      *
+* lists the objects whose bounds overlap it.  A ray walks the cells it     *
+* crosses in order with a 3D-DDA, testing the objects of each one, and     *
+* stops at the first cell that ends beyond the closest hit found so far.   *
+*                                                                          *
+* The number of cells grows with the number of objects, so that there are *
+* a few cells per object, and the cells are kept as close to cubes as the  *
+* box allows.  The grid is built in linear time, which suits scenes of     *
+* many objects of similar size, like packs of spheres.                     *
+*                                                                          *
+* With two levels, the cells of a coarser grid that hold many objects are  *
+* refined with a grid of their own, which copes better with objects that  *
+* are not spread evenly.                                                   *
+*                                                                          *
+***************************************************************************/
+
+#include <vector>
+
+#include "Accelerator.h"
+#include "Primitives.h"
+
+class GridLevel // A single grid, whose cells list the objects they overlap.
+{
+	public:
+		Box3 box;						// Bounds of the grid.
+		int  res[3];					// Number of cells along each axis.
+		Vec3 cell_size;
+		std::vector<int>     start;		// Cell c lists refs[start[c]] to refs[start[c + 1] - 1].
+		std::vector<Object*> refs;
+		Primitives           primitives;	// The objects of refs compiled, which the walk tests.
+		std::vector<int>     subgrid;	// Index of the grid that refines each cell, -1 if none (two levels only).
+
+		GridLevel() { box = EmptyBox(); res[0] = res[1] = res[2] = 0; }
+		int NumCells() const { return res[0] * res[1] * res[2]; }
+};
+
+class Grid : public Accelerator
+{
+	public:
+		Grid( bool two_level = false ) { two_levels = two_level; first_object = NULL; }
+		virtual ~Grid() {}
+
+		void Build( Object *first );
+		const Object *Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore = NULL ) const;
+		bool Occluded( const Ray &ray, double max_distance, const Object *ignore = NULL ) const;
+		void Refit();
+		double Cost() const;
+		const char *Name() const { return two_levels ? "grid2" : "grid"; }
+		void Report( ostream &out ) const;
+		void GetTreeStats( TreeStats &stats ) const;
+
+	private:
+		bool                   two_levels;
+		Object                *first_object;	// List the grid was built over, to rebuild it on refits.
+		GridLevel              top;
+		std::vector<GridLevel> subgrids;		// Grids refining the crowded cells of the top one.
+
+		template <class Visitor>
+		void Walk( const GridLevel &level, const Ray &ray, const Vec3 &inv_dir, double t_min, double t_max, Visitor &visit ) const;
+};
+
+#endif
\ No newline at end of file
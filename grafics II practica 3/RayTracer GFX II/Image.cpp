@@ -1,3 +1,5 @@
+#include <math.h>
+
 #include "Image.h"
 
 Pixel::Pixel()
@@ -50,4 +52,34 @@ bool Image::Write( const char *file_name )
 	}
     fclose( fp );
     return true;
+}
+
+bool Image::Read( const char *file_name )
+{
+    int w, h, max;
+    FILE *fp = fopen( file_name, "rb" );
+    if( fp == NULL ) return false;
+    if( fscanf( fp, "P6 %d %d %d", &w, &h, &max ) != 3 || w != width || h != height || max != 255 || fgetc( fp ) != '\n' )
+    {
+        fclose( fp );
+        return false;
+    }
+	bool ok = true;
+	for( int i = height-1; i >= 0 && ok; i-- )
+		ok = fread( &(pixels[width*i]), sizeof( Pixel ), width, fp ) == (size_t)width;
+    fclose( fp );
+    return ok;
+}
+
+double Image::RMSE( const Image &other ) const
+{
+	double sum = 0.0;
+	const channel *a = &pixels[0].r;
+	const channel *b = &other.pixels[0].r;
+	for( int i = 0; i < 3 * width * height; i++ )
+	{
+		double d = double( a[i] ) - double( b[i] );
+		sum += d * d;
+	}
+	return sqrt( sum / ( 3.0 * width * height ) );
 }
\ No newline at end of file
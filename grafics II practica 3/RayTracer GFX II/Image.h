@@ -37,6 +37,8 @@ class Image
 		Image( int x_res, int y_res );
 		~Image();
 		bool Write( const char *file_name );
+		bool Read( const char *file_name );			// Only a PPM written by Write, of the same size.
+		double RMSE( const Image &other ) const;	// Root mean square difference of the channels, from 0 to 255.
 		Pixel &operator()( int i, int j );
 };
 
@@ -0,0 +1,114 @@
+#include "Instance.h"
+
+// Rotation of "degrees" around one of the coordinate axes.
+static Mat3x3 Rotation( int axis, double degrees )
+{
+	Mat3x3 R = Mat3x3::Identity();
+	double c = cos( degrees * Pi / 180.0 );
+	double s = sin( degrees * Pi / 180.0 );
+	int i = ( axis + 1 ) % 3;
+	int j = ( axis + 2 ) % 3;
+
+	R(i,i) = c;  R(i,j) = -s;
+	R(j,i) = s;  R(j,j) =  c;
+	return R;
+}
+
+Instance::Instance( const BVH *geometry_, const Vec3 &translation, const Vec3 &rotation, const Vec3 &scale )
+{
+	geometry = geometry_;
+	SetTransform( translation, rotation, scale );
+	next = NULL;
+}
+
+void Instance::SetTransform( const Vec3 &translation, const Vec3 &rotation, const Vec3 &scale )
+{
+	Mat3x3 S;
+	S(0,0) = scale.x;
+	S(1,1) = scale.y;
+	S(2,2) = scale.z;
+
+	T = translation;
+	M = Rotation( 2, rotation.z ) * Rotation( 1, rotation.y ) * Rotation( 0, rotation.x ) * S;
+	Minv = ( 1 / det( M ) ) * Transpose( Adjoint( M ) );
+	Mnormal = Transpose( Minv );
+
+	// Bounds of the eight transformed corners of the box of the group.
+	Box3 local = geometry->GetBounds();
+	box = EmptyBox();
+	for( int k = 0; k < 8; k++ )
+	{
+		Vec3 corner( ( k & 1 ) ? local.X.max : local.X.min,
+					 ( k & 2 ) ? local.Y.max : local.Y.min,
+					 ( k & 4 ) ? local.Z.max : local.Z.min );
+		Vec3 P = M * corner + T;
+		Box3 point;
+		point.X.min = point.X.max = P.x;
+		point.Y.min = point.Y.max = P.y;
+		point.Z.min = point.Z.max = P.z;
+		box = Union( box, point );
+	}
+}
+
+Box3 Instance::GetBounds() const
+{
+	return box;
+}
+
+// The transform; the group is only known by its bounds.
+unsigned long long Instance::Hash( unsigned long long hash ) const
+{
+	hash = Object::Hash( hash );
+	hash = HashBytes( hash, &M, sizeof( M ) );
+	return HashBytes( hash, &T, sizeof( T ) );
+}
+
+// Moves the ray into the space of the group, keeping its direction a unit
+// vector.  Returns the length, in the space of the group, of a unit of
+// distance along the world ray.
+double Instance::ToLocal( const Ray &ray, Ray &local ) const
+{
+	Vec3 direction = Minv * ray.direction;
+	double scale = Length( direction );
+
+	local.origin      = Minv * ( ray.origin - T );
+	local.direction   = direction / scale;
+	local.no_emitters = ray.no_emitters;
+	return scale;
+}
+
+const Object *Instance::Hit( const Ray &ray, HitGeom &hitgeom ) const
+{
+	Ray local;
+	HitGeom local_geom;
+
+	double scale = ToLocal( ray, local );
+	local_geom.distance = Scalar( hitgeom.distance * scale );
+
+	const Object *object = geometry->Intersect( local, local_geom );
+	if( object == NULL ) return NULL;
+
+	// Only the object hit knows its normal, and only in the space of the
+	// group, so the hit is finished here rather than after the traversal.
+	local_geom.object->GetHitAttributes( local, local_geom );
+
+	// Move the hit back to the world.
+	hitgeom.distance = Scalar( local_geom.distance / scale );
+	hitgeom.point    = ray.origin + hitgeom.distance * ray.direction;
+	hitgeom.normal   = Unit( Mnormal * local_geom.normal );
+	hitgeom.origin   = ray.origin;
+	hitgeom.object   = this;
+	return object;
+}
+
+bool Instance::Intersect( const Ray &ray, HitGeom &hitgeom ) const
+{
+	return Hit( ray, hitgeom ) != NULL;
+}
+
+bool Instance::Occludes( const Ray &ray, double max_distance ) const
+{
+	Ray local;
+	double scale = ToLocal( ray, local );
+	return geometry->Occluded( local, max_distance * scale );
+}
@@ -0,0 +1,41 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+// An instance places a copy of a named group of objects in the scene.  The
+// objects of the group are stored only once, together with their own
+// bottom-level BVH; every instance just keeps a pointer to that BVH and
+// the transform from the space of the group to the world.  To intersect a
+// ray, it is moved into the space of the group, traced through the BVH
+// there, and the hit found is finished and moved back to the world.  The transform is
+// a translation, a rotation around X, Y and Z (in degrees, applied in
+// that order) and a scale along each axis, applied first.  It can be
+// changed with SetTransform to move the instance, after which the scene
+// accelerator has to be updated.
+
+#include "Object.h"
+#include "Mat3x3.h"
+#include "BVH.h"
+
+class Instance : public Object
+{
+	public:
+		const BVH *geometry;	// Bottom-level hierarchy of the group.
+		Mat3x3 M;				// Linear part of the transform, from the group to the world.
+		Mat3x3 Minv;			// Its inverse, from the world to the group.
+		Mat3x3 Mnormal;			// Transpose of Minv, which transforms the normals.
+		Vec3   T;				// Translation.
+		Box3   box;				// Bounds of the transformed group.
+
+		Instance( const BVH *geometry, const Vec3 &translation, const Vec3 &rotation, const Vec3 &scale );
+		void SetTransform( const Vec3 &translation, const Vec3 &rotation, const Vec3 &scale );
+		bool Intersect( const Ray &ray, HitGeom &hitgeom ) const;
+		bool Occludes( const Ray &ray, double max_distance ) const;
+		const Object *Hit( const Ray &ray, HitGeom &hitgeom ) const;
+		Box3 GetBounds() const;
+		unsigned long long Hash( unsigned long long hash ) const;
+
+	private:
+		double ToLocal( const Ray &ray, Ray &local ) const;
+};
+
+#endif
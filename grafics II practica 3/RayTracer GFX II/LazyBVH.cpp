@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <chrono>
+
+#include "LazyBVH.h"
+
+static const int    MaxLeafSize   = 4;
+static const int    MaxDepth      = 60;		// Keeps the traversal stack bounded on degenerate inputs
+static const int    StackSize     = 64;
+static const int    EagerDepth    = 3;		// Levels split by Build, before any ray is traced
+static const int    BlockShift    = 12;		// Nodes are allocated in blocks of 2^BlockShift
+static const int    BlockSize     = 1 << BlockShift;
+static const int    Unbuilt       = -1;		// Values of LazyNode::child for nodes that are not inner nodes
+static const int    Leaf          = -2;
+
+LazyNode &LazyBVH::Node( int index ) const
+{
+	return blocks[index >> BlockShift][index & ( BlockSize - 1 )];
+}
+
+// Hands out "count" consecutive nodes, allocating the blocks they fall in.
+// Called with build_lock held, or before any ray is traced.
+int LazyBVH::NewNodes( int count ) const
+{
+	int index = num_nodes;
+	num_nodes += count;
+	for( int b = index >> BlockShift; b <= ( num_nodes - 1 ) >> BlockShift; b++ )
+	{
+		if( blocks[b] == NULL ) blocks[b] = new LazyNode[BlockSize];
+	}
+	return index;
+}
+
+void LazyBVH::FreeNodes()
+{
+	for( size_t b = 0; b < blocks.size(); b++ ) delete [] blocks[b];
+	blocks.clear();
+	num_nodes = 0;
+}
+
+void LazyBVH::Build( Object *first )
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	FreeNodes();
+	prims.clear();
+	first_object = first;
+
+	for( Object *object = first; object != NULL; object = object->next )
+	{
+		BVHPrim prim;
+		prim.box    = object->GetBounds();
+		prim.center = Center( prim.box );
+		prim.object = object;
+		prims.push_back( prim );
+	}
+	num_objects = (int)prims.size();
+	if( prims.empty() ) return;
+
+	// A binary tree with at least one object per leaf has fewer than twice
+	// as many nodes as objects, so the table of blocks never has to grow
+	// while rays are reading it.
+	blocks.assign( ( 2 * prims.size() + BlockSize - 1 ) >> BlockShift, NULL );
+
+	LazyNode &root = Node( NewNodes( 1 ) );
+	root.box = EmptyBox();
+	for( size_t i = 0; i < prims.size(); i++ ) root.box = Union( root.box, prims[i].box );
+	root.begin = 0;
+	root.end   = (int)prims.size();
+	root.depth = 0;
+	root.axis  = 0;
+	root.child.store( Unbuilt, std::memory_order_relaxed );
+
+	// Split the top of the tree, so that the first rays do not all wait
+	// on the few large nodes near the root.
+	for( int i = 0; i < num_nodes; i++ )
+	{
+		if( Node( i ).depth < EagerDepth ) Expand( i );
+	}
+
+	build_time = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+	build_cost = Cost();
+}
+
+// Splits an unbuilt node with the binned SAH, or makes it a leaf when no
+// split is cheaper than intersecting its objects.  Its children are left
+// unbuilt.
+void LazyBVH::Expand( int index ) const
+{
+	std::lock_guard<std::mutex> lock( build_lock );
+	LazyNode &node = Node( index );
+
+	// Another ray may have split it while this one waited for the lock.
+	if( node.child.load( std::memory_order_relaxed ) != Unbuilt ) return;
+
+	int count = node.end - node.begin;
+	ObjectSplit best;
+	best.cost = Infinity;
+	best.axis = -1;
+	if( count > 1 && node.depth < MaxDepth ) best = FindObjectSplit( prims, node.begin, node.end, node.box );
+
+	int split;
+	if( best.axis < 0 || ( count <= MaxLeafSize && IntersectCost * count <= best.cost ) )
+	{
+		if( best.axis >= 0 || count <= MaxLeafSize || node.depth >= MaxDepth )
+		{
+			node.child.store( Leaf, std::memory_order_release );
+			return;
+		}
+		// Too many objects with coincident centers: split them in halves.
+		split = node.begin + count / 2;
+		best.axis = 0;
+		best.left = best.right = EmptyBox();
+		for( int i = node.begin; i < split; i++ ) best.left = Union( best.left, prims[i].box );
+		for( int i = split; i < node.end; i++ ) best.right = Union( best.right, prims[i].box );
+	}
+	else
+	{
+		BVHPrim *middle = std::partition( &prims[0] + node.begin, &prims[0] + node.end, [&]( const BVHPrim &p )
+		{
+			return best.Bin( p ) < best.bin;
+		} );
+		split = (int)( middle - &prims[0] );
+	}
+
+	int first = NewNodes( 2 );
+	LazyNode &left  = Node( first );
+	LazyNode &right = Node( first + 1 );
+	left.box    = best.left;
+	left.begin  = node.begin;
+	left.end    = split;
+	right.box   = best.right;
+	right.begin = split;
+	right.end   = node.end;
+	left.depth  = right.depth = node.depth + 1;
+	left.axis   = right.axis  = 0;
+	left.child.store( Unbuilt, std::memory_order_relaxed );
+	right.child.store( Unbuilt, std::memory_order_relaxed );
+
+	// Publish the children: a ray that reads the index also sees them.
+	node.axis = best.axis;
+	node.child.store( first, std::memory_order_release );
+}
+
+// Building is cheap up front, so a refit just starts a new tree over the
+// objects where they are now.
+void LazyBVH::Refit()
+{
+	double seconds = build_time;
+	Build( first_object );
+	refit_time = build_time;
+	build_time = seconds;
+}
+
+// SAH cost of the tree built so far, taking unbuilt nodes as leaves.  It
+// drops as rays split more nodes.
+double LazyBVH::Cost() const
+{
+	double cost = 0.0;
+	double object_area = 0.0;
+
+	for( int i = 0; i < num_nodes; i++ )
+	{
+		const LazyNode &node = Node( i );
+		int child = node.child.load( std::memory_order_acquire );
+		double work = child < 0 ? IntersectCost * ( node.end - node.begin ) : TraversalCost;
+		cost += SurfaceArea( node.box ) * work;
+	}
+	for( size_t i = 0; i < prims.size(); i++ ) object_area += SurfaceArea( prims[i].box );
+	return object_area > 0.0 ? cost / object_area : cost;
+}
+
+void LazyBVH::Report( ostream &out ) const
+{
+	out << "Lazy BVH split " << EagerDepth << " levels in " << build_time * 1000.0 << " ms: "
+		<< NumNodes() << " nodes over " << num_objects << " objects so far, SAH cost " << build_cost << "." << endl;
+}
+
+// Shape of the tree built so far; unbuilt nodes count as leaves.
+void LazyBVH::GetTreeStats( TreeStats &stats ) const
+{
+	std::vector< std::pair<int, int> > stack;	// Nodes left to visit, with their depth.
+
+	if( num_nodes > 0 ) stack.push_back( std::make_pair( 0, 0 ) );
+	while( !stack.empty() )
+	{
+		const LazyNode &node = Node( stack.back().first );
+		int depth = stack.back().second;
+		stack.pop_back();
+
+		int child = node.child.load( std::memory_order_acquire );
+		if( child < 0 ) stats.AddLeaf( node.end - node.begin, depth );
+		else
+		{
+			stack.push_back( std::make_pair( child, depth + 1 ) );
+			stack.push_back( std::make_pair( child + 1, depth + 1 ) );
+		}
+	}
+}
+
+const Object *LazyBVH::Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore ) const
+{
+	QueryCount work;
+	const Object *hit = NULL;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( prims.empty() ) return NULL;
+
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+	bool negative[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	for(;;)
+	{
+		const LazyNode &node = Node( current );
+		work.nodes++;
+
+		if( HitBox( node.box, ray.origin, inv_dir, hitgeom.distance ) )
+		{
+			int child = node.child.load( std::memory_order_acquire );
+			if( child == Unbuilt )
+			{
+				Expand( current );
+				child = node.child.load( std::memory_order_acquire );
+			}
+
+			if( child == Leaf )
+			{
+				for( int i = node.begin; i < node.end; i++ )
+				{
+					const Object *object = prims[i].object;
+					work.primitives++;
+					if( object == ignore ) continue;
+					if( ( object = object->Hit( ray, hitgeom ) ) != NULL ) hit = object;
+				}
+			}
+			else
+			{
+				// Visit the child nearer to the ray origin first.
+				if( negative[node.axis] )
+				{
+					stack[sp++] = child;
+					current = child + 1;
+				}
+				else
+				{
+					stack[sp++] = child + 1;
+					current = child;
+				}
+				continue;
+			}
+		}
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return hit;
+}
+
+bool LazyBVH::Occluded( const Ray &ray, double max_distance, const Object *ignore ) const
+{
+	QueryCount work;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( prims.empty() ) return false;
+
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+
+	for(;;)
+	{
+		const LazyNode &node = Node( current );
+		work.nodes++;
+
+		if( HitBox( node.box, ray.origin, inv_dir, max_distance ) )
+		{
+			int child = node.child.load( std::memory_order_acquire );
+			if( child == Unbuilt )
+			{
+				Expand( current );
+				child = node.child.load( std::memory_order_acquire );
+			}
+
+			if( child == Leaf )
+			{
+				for( int i = node.begin; i < node.end; i++ )
+				{
+					const Object *object = prims[i].object;
+					work.primitives++;
+					if( object != ignore && object->Occludes( ray, max_distance ) ) return true;
+				}
+			}
+			else
+			{
+				stack[sp++] = child + 1;
+				current = child;
+				continue;
+			}
+		}
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return false;
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+#ifndef LAZYBVH_H
+#define LAZYBVH_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines a bounding volume hierarchy that is built on demand.   *
+* Building the whole tree over a huge scene delays the first image, and    *
+* many of its subtrees may never be entered by a ray.  Here, Build only    *
+* bounds the objects and splits the root, leaving every child as an        *
+* unbuilt range of build records with its box.  The first ray that enters  *
+* an unbuilt node splits it with the same binned SAH as the BVH builder,   *
+* turning it into an inner node with two unbuilt children, or into a leaf. *
+* So the tree grows towards where the rays go, and the parts of the scene  *
+* that are never seen are never built.                                     *
+*                                                                          *
+* Nodes are split under a lock, while other rays may be walking the tree   *
+* without one.  A node becomes visible to them through its "child" field,  *
+* which is written last, with release semantics, once its children are     *
+* complete; rays read it with acquire semantics.  The nodes are kept in    *
+* blocks that never move, so that growing the tree does not invalidate     *
+* the nodes other rays are looking at.                                     *
+*                                                                          *
+***************************************************************************/
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "BVH.h"
+
+class LazyNode // A node of the lazy hierarchy.
+{
+	public:
+		Box3             box;	// Bounds of all the objects below this node.
+		int              begin;	// Build records of the node: prims[begin, end).
+		int              end;
+		int              depth;	// Levels between the root and this node.
+		int              axis;	// Axis used to split an inner node; the first child is on its lower side.
+		std::atomic<int> child;	// Inner node: index of the first of its two children, the second one
+								// is next.  -1 while the node is unbuilt, -2 once it is a leaf.
+};
+
+class LazyBVH : public Accelerator
+{
+	public:
+		LazyBVH() { first_object = NULL; num_objects = num_nodes = 0; }
+		virtual ~LazyBVH() { FreeNodes(); }
+
+		void Build( Object *first );
+		const Object *Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore = NULL ) const;
+		bool Occluded( const Ray &ray, double max_distance, const Object *ignore = NULL ) const;
+		void Refit();
+		double Cost() const;
+		const char *Name() const { return "lazybvh"; }
+		void Report( ostream &out ) const;
+		void GetTreeStats( TreeStats &stats ) const;
+
+		int NumNodes() const { return num_nodes; }	// Nodes built so far.
+
+	private:
+		Object                        *first_object;	// List the tree was built over, to rebuild it on refits.
+		int                            num_objects;
+		mutable std::vector<BVHPrim>   prims;		// Build records, reordered as the nodes are split.
+		mutable std::vector<LazyNode*> blocks;		// Blocks of BlockSize nodes, allocated as the tree grows.
+		mutable int                    num_nodes;
+		mutable std::mutex             build_lock;	// Held while a node is split.
+
+		LazyNode &Node( int index ) const;
+		int NewNodes( int count ) const;
+		void Expand( int index ) const;
+		void FreeNodes();
+};
+
+#endif
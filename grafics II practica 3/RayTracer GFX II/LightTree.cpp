@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <math.h>
+
+#include "LightTree.h"
+
+static const double MaxSpread = 0.5 * Pi;	// A cone of lines this wide holds every direction
+
+static inline double Clamp( double x, double lo, double hi )
+{
+	return x < lo ? lo : ( x > hi ? hi : x );
+}
+
+// Smallest cone of lines that holds the cones of A and B, written to A.
+static void MergeCones( Vec3 &axis, double &spread, Vec3 other_axis, double other_spread )
+{
+	// A line can be given by either of its directions; take the closest one.
+	double cos_angle = axis * other_axis;
+	if( cos_angle < 0.0 )
+	{
+		other_axis = -other_axis;
+		cos_angle = -cos_angle;
+	}
+	double angle = acos( Clamp( cos_angle, -1.0, 1.0 ) );
+
+	if( angle + other_spread <= spread ) return;
+	if( angle + spread <= other_spread )
+	{
+		axis = other_axis;
+		spread = other_spread;
+		return;
+	}
+
+	double merged = 0.5 * ( spread + angle + other_spread );
+	if( merged >= MaxSpread )
+	{
+		spread = MaxSpread;
+		return;
+	}
+
+	// Turn the axis towards the other one until the new cone touches both.
+	Vec3 side = other_axis - cos_angle * axis;
+	if( LengthSquared( side ) > 0.0 )
+		axis = Unit( cos( merged - spread ) * axis + sin( merged - spread ) * Unit( side ) );
+	spread = merged;
+}
+
+// Orders the lights by the center of their bounds along one axis.
+class LightCenterLess
+{
+	public:
+		int axis;
+		LightCenterLess( int a ) { axis = a; }
+		bool operator()( const LightNode &a, const LightNode &b ) const
+		{
+			return Component( Center( a.box ), axis ) < Component( Center( b.box ), axis );
+		}
+};
+
+void LightTree::Build( Object *first, const MaterialTable &materials )
+{
+	std::vector<LightNode> leaves;
+
+	nodes.clear();
+	lights.clear();
+
+	for( Object *object = first; object != NULL; object = object->next )
+	{
+		const Material &material = materials[object->material_id];
+		if( !material.Emitter() ) continue;
+
+		const Color &emission = material.m_Emission;
+		LightNode leaf;
+		leaf.box    = object->GetBounds();
+		leaf.power  = object->Area() * ( emission.red + emission.green + emission.blue ) / 3.0;
+		leaf.offset = (int)lights.size();
+		leaf.count  = 1;
+		object->GetNormalCone( leaf.axis, leaf.spread );
+		if( leaf.spread > MaxSpread ) leaf.spread = MaxSpread;
+		leaves.push_back( leaf );
+		lights.push_back( object );
+	}
+	if( leaves.empty() ) return;
+
+	nodes.reserve( 2 * leaves.size() );
+	BuildNode( leaves, 0, (int)leaves.size() );
+}
+
+// Builds the subtree for leaves[begin, end) and returns the index of its
+// root.  The lights are split in halves at the median of their centers,
+// along the axis the centers spread the most.
+int LightTree::BuildNode( std::vector<LightNode> &leaves, int begin, int end )
+{
+	int index = (int)nodes.size();
+
+	if( end - begin == 1 )
+	{
+		nodes.push_back( leaves[begin] );
+		return index;
+	}
+	nodes.push_back( LightNode() );
+
+	Box3 centers = EmptyBox();
+	for( int i = begin; i < end; i++ )
+	{
+		Vec3 c = Center( leaves[i].box );
+		Box3 point;
+		point.X.min = point.X.max = c.x;
+		point.Y.min = point.Y.max = c.y;
+		point.Z.min = point.Z.max = c.z;
+		centers = Union( centers, point );
+	}
+	int axis = 0;
+	for( int a = 1; a < 3; a++ )
+	{
+		if( Along( centers, a ).max - Along( centers, a ).min > Along( centers, axis ).max - Along( centers, axis ).min ) axis = a;
+	}
+
+	int middle = ( begin + end ) / 2;
+	std::nth_element( leaves.begin() + begin, leaves.begin() + middle, leaves.begin() + end, LightCenterLess( axis ) );
+
+	BuildNode( leaves, begin, middle );
+	int second = BuildNode( leaves, middle, end );
+
+	LightNode node = nodes[index + 1];
+	MergeCones( node.axis, node.spread, nodes[second].axis, nodes[second].spread );
+	node.box    = Union( node.box, nodes[second].box );
+	node.power += nodes[second].power;
+	node.offset = second;
+	node.count  = 0;
+	nodes[index] = node;
+	return index;
+}
+
+// Bound on the light the node sends to point P, with normal N.  It is its
+// power over the squared distance to the center of its box, times the
+// cosines of the smallest angles the box allows: between the direction to
+// P and the normals of the lights, and between N and the direction to the
+// lights.  Lights whose normals all lie in the plane of P, or entirely
+// below the surface at P, give nothing.
+static double Importance( const LightNode &node, const Vec3 &P, const Vec3 &N )
+{
+	Vec3   v  = P - Center( node.box );
+	double d2 = LengthSquared( v );
+	double r2 = 0.25 * ( ( node.box.X.max - node.box.X.min ) * ( node.box.X.max - node.box.X.min ) +
+						 ( node.box.Y.max - node.box.Y.min ) * ( node.box.Y.max - node.box.Y.min ) +
+						 ( node.box.Z.max - node.box.Z.min ) * ( node.box.Z.max - node.box.Z.min ) );
+
+	// Inside the sphere around the box every direction is possible.
+	if( d2 <= r2 ) return r2 > 0.0 ? node.power / r2 : node.power;
+
+	double d = sqrt( d2 );
+	double bound_angle = asin( sqrt( r2 / d2 ) );	// Half the angle the box spans from P
+
+	double emit_angle = acos( Clamp( fabs( node.axis * v ) / d, 0.0, 1.0 ) ) - node.spread - bound_angle;
+	double receive_angle = acos( Clamp( -( N * v ) / d, -1.0, 1.0 ) ) - bound_angle;
+	if( emit_angle < 0.0 ) emit_angle = 0.0;
+	if( receive_angle < 0.0 ) receive_angle = 0.0;
+	if( emit_angle >= MaxSpread || receive_angle >= MaxSpread ) return 0.0;
+
+	return node.power * cos( emit_angle ) * cos( receive_angle ) / d2;
+}
+
+const Object *LightTree::Pick( const Vec3 &P, const Vec3 &N, double &probability ) const
+{
+	int current = 0;
+
+	probability = 1.0;
+	if( nodes.empty() ) return NULL;
+
+	while( nodes[current].count == 0 )
+	{
+		double a = Importance( nodes[current + 1], P, N );
+		double b = Importance( nodes[nodes[current].offset], P, N );
+		if( a + b <= 0.0 ) return NULL;
+
+		double p = a / ( a + b );
+		if( b <= 0.0 || ( a > 0.0 && rand( 0.0, 1.0 ) < p ) )
+		{
+			current = current + 1;
+			probability *= p;
+		}
+		else
+		{
+			current = nodes[current].offset;
+			probability *= 1.0 - p;
+		}
+	}
+	return lights[nodes[current].offset];
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#ifndef LIGHTTREE_H
+#define LIGHTTREE_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines a hierarchy over the emitters of a scene, used to pick *
+* the light sampled at each shading point instead of sampling all of them. *
+* Every node stores the total power of the lights below it, the box that   *
+* bounds them, and a cone that holds the directions of their normals.      *
+* From those, the light a node sends towards a point can be bounded: it    *
+* falls with the square of the distance to the box, and with the angle     *
+* between the direction to the point and the closest normal in the cone.   *
+*                                                                          *
+* To pick a light, the tree is walked from the root choosing each child    *
+* with a probability proportional to that estimate, so the cost grows with *
+* the logarithm of the number of lights, and the lights that matter at a   *
+* point are picked most often.  The probability of the light picked is     *
+* returned too, so that its sample can be weighted to keep the estimate of *
+* the direct light unbiased.                                               *
+*                                                                          *
+* Emitters shine on both sides, so the cones are lines of directions: a    *
+* normal and its opposite are the same.                                    *
+*                                                                          *
+***************************************************************************/
+
+#include <vector>
+
+#include "Object.h"
+
+class LightNode // A node of the light hierarchy.
+{
+	public:
+		Box3   box;		// Bounds of all the lights below this node.
+		Vec3   axis;	// Axis of the cone of normals.
+		double spread;	// Angle between the axis and the normals furthest from it, up to Pi / 2.
+		double power;	// Total power emitted by the lights below this node.
+		int    offset;	// Leaf: index of its light. Inner node: index of its second child.
+		int    count;	// 1 for leaves, 0 for inner nodes, whose first child is the next node.
+};
+
+class LightTree
+{
+	public:
+		LightTree() {}
+
+		// Builds the hierarchy over the emitters of the list of objects,
+		// whose materials are in the given table.
+		void Build( Object *first, const MaterialTable &materials );
+
+		// Picks a light to sample from point P, with normal N.  Returns the
+		// light and the probability it had of being picked, or NULL if no
+		// light can reach P.
+		const Object *Pick( const Vec3 &P, const Vec3 &N, double &probability ) const;
+
+		int NumLights() const { return (int)lights.size(); }
+
+	private:
+		std::vector<LightNode>     nodes;
+		std::vector<const Object*> lights;
+
+		int BuildNode( std::vector<LightNode> &leaves, int begin, int end );
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "Material.h"
+#include "Utils.h"
+
+void Material::Precompute()
+{
+	m_DiffuseWeight  = float( ( m_Diffuse.blue  + m_Diffuse.red  + m_Diffuse.green  ) / 3 );
+	m_SpecularWeight = float( ( m_Specular.blue + m_Specular.red + m_Specular.green ) / 3 );
+	m_PhongNorm      = ( m_Phong_exp + 2 ) / ( 2 * Pi );
+	m_Emitter        = m_Emission.red != 0 || m_Emission.blue != 0 || m_Emission.green != 0;
+}
+
+// Compares two colors channel by channel.  Returns -1, 0 or 1.
+static int Compare( const Color &a, const Color &b )
+{
+	if( a.red   != b.red   ) return a.red   < b.red   ? -1 : 1;
+	if( a.green != b.green ) return a.green < b.green ? -1 : 1;
+	if( a.blue  != b.blue  ) return a.blue  < b.blue  ? -1 : 1;
+	return 0;
+}
+
+// Only the parameters read from the scene count; the rest follows from them.
+bool MaterialTable::Less::operator()( const Material &a, const Material &b ) const
+{
+	int c;
+	if( ( c = Compare( a.m_Diffuse,  b.m_Diffuse  ) ) != 0 ) return c < 0;
+	if( ( c = Compare( a.m_Specular, b.m_Specular ) ) != 0 ) return c < 0;
+	if( ( c = Compare( a.m_Emission, b.m_Emission ) ) != 0 ) return c < 0;
+	if( a.m_Type            != b.m_Type            ) return a.m_Type            < b.m_Type;
+	if( a.m_Phong_exp       != b.m_Phong_exp       ) return a.m_Phong_exp       < b.m_Phong_exp;
+	if( a.m_Reflectivity    != b.m_Reflectivity    ) return a.m_Reflectivity    < b.m_Reflectivity;
+	if( a.m_RefractiveIndex != b.m_RefractiveIndex ) return a.m_RefractiveIndex < b.m_RefractiveIndex;
+	return a.m_Opacity < b.m_Opacity;
+}
+
+MaterialTable::MaterialTable()
+{
+	Add( Material() );
+}
+
+unsigned int MaterialTable::Add( const Material &material )
+{
+	std::map<Material, unsigned int, Less>::iterator it = index.find( material );
+	if( it != index.end() ) return it->second;
+
+	unsigned int id = (unsigned int)materials.size();
+	materials.push_back( material );
+	materials.back().Precompute();
+	index[material] = id;
+	return id;
+}
\ No newline at end of file
@@ -1,9 +1,12 @@
 #ifndef MATERIAL_H
 #define MATERIAL_H
 
+#include <vector>
+#include <map>
+
 #include "Color.h"
 	// Surface material for shading.
-	class Material 
+	class Material
 	{
 		public:
 			Color m_Diffuse;      // Diffuse color.
@@ -14,7 +17,46 @@
 			float m_Reflectivity; // Weight given to mirror reflection, between 0 and 1.
 			float m_RefractiveIndex;	// (vel. llum en el buit) / (vel. llum en aquest material)
 			float m_Opacity;			// [0-1] 0:transparent, 1:opac
-			bool  Emitter() const { return ( m_Emission.red != 0 || m_Emission.blue != 0 || m_Emission.green != 0 ); } 
+
+			// Worked out from the parameters above by Precompute, which the
+			// material table calls when the material is added to it.
+			float  m_DiffuseWeight;		// Mean of the diffuse channels: odds of bouncing a diffuse ray.
+			float  m_SpecularWeight;	// Mean of the specular channels: odds of bouncing a specular ray.
+			double m_PhongNorm;			// (m_Phong_exp + 2) / 2 Pi, which normalizes the Phong lobe.
+			bool   m_Emitter;			// True if any channel of m_Emission is not zero.
+
+			// The scene file only gives the parameters an object uses; the
+			// rest must not be left to whatever the memory held.
+			Material() { m_Type = 0; m_Phong_exp = m_Reflectivity = 0.0f; m_RefractiveIndex = m_Opacity = 1.0f; Precompute(); }
+			bool  Emitter() const { return m_Emitter; }
+			void  Precompute();
+	};
+
+	// The materials of a scene, each stored once however many objects use
+	// it.  Objects and hits refer to them by their index in the table, so a
+	// hit carries four bytes instead of a copy of the whole material.  Index
+	// 0 is the default material, which objects start with.
+	class MaterialTable
+	{
+		public:
+			MaterialTable();
+
+			// Returns the index of a material with the same parameters,
+			// adding this one if there is none.
+			unsigned int Add( const Material &material );
+
+			const Material &operator[]( unsigned int id ) const { return materials[id]; }
+			int Size() const { return (int)materials.size(); }
+
+		private:
+			class Less // Orders materials by their parameters, to find the duplicates.
+			{
+				public:
+					bool operator()( const Material &a, const Material &b ) const;
+			};
+
+			std::vector<Material>                      materials;
+			std::map<Material, unsigned int, Less>     index;	// Position of every material in "materials".
 	};
 
 #endif
\ No newline at end of file
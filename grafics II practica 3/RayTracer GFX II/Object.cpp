@@ -1,6 +1,59 @@
+#include <string.h>
+#include <typeinfo>
+
 #include "Object.h"
 
 Object::Object()
 {
+	material_id = 0;
 	next = NULL;
+}
+
+// Returns true if the ray hits the object closer than max_distance.
+bool Object::Occludes( const Ray &ray, double max_distance ) const
+{
+	HitGeom hitgeom;
+	hitgeom.distance = Scalar( max_distance );
+	return Intersect( ray, hitgeom );
+}
+
+// Returns this object if the ray hits it closer than hitgeom.distance,
+// filling hitgeom like Intersect, or NULL otherwise.
+const Object *Object::Hit( const Ray &ray, HitGeom &hitgeom ) const
+{
+	if( !Intersect( ray, hitgeom ) ) return NULL;
+	hitgeom.object = this;
+	return this;
+}
+
+// Cuts the box in two at the plane.  The object is assumed to fill it.
+void Object::Split( const Box3 &box, int axis, double position, Box3 &left, Box3 &right ) const
+{
+	left  = box;
+	right = box;
+	Along( left, axis ).max  = Scalar( position );
+	Along( right, axis ).min = Scalar( position );
+}
+
+// Area of the surface, estimated by that of the bounds.
+double Object::Area() const
+{
+	return SurfaceArea( GetBounds() );
+}
+
+// Directions of the normals of the surface: all within "spread" radians
+// of the line along "axis", either way.  Without more knowledge, the
+// normals may point anywhere, which a spread of Pi / 2 covers.
+void Object::GetNormalCone( Vec3 &axis, double &spread ) const
+{
+	axis = Vec3( 0.0, 0.0, 1.0 );
+	spread = 0.5 * Pi;
+}
+
+unsigned long long Object::Hash( unsigned long long hash ) const
+{
+	const char *type = typeid( *this ).name();
+	Box3 box = GetBounds();
+	hash = HashBytes( hash, type, strlen( type ) );
+	return HashBytes( hash, &box, sizeof( box ) );
 }
\ No newline at end of file
@@ -14,6 +14,34 @@
 * further away than hitgeom.distance, it is to report failure (i.e. return *
 * false).                                                                  * 
 *                                                                          *
+* Shadow rays only need to know whether something lies in between, so      *
+* they use the Occludes method instead, which answers that question        *
+* without writing any hit information.  Objects that do not provide a      *
+* cheaper test fall back to Intersect.                                     *
+*                                                                          *
+* The accelerators call Hit, which returns the object whose surface was    *
+* hit, so that its material can be used.  That is the object itself,       *
+* except for composite objects like instances, which return the object     *
+* hit inside them.  Hit only has to record the distance, the part of the   *
+* object that was hit and, in hitgeom.object, the object that can tell     *
+* the rest.  Most hits found during a traversal are replaced by closer     *
+* ones, so the point, normal and origin are only worked out for the last   *
+* one, by calling GetHitAttributes on hitgeom.object once the traversal    *
+* is over.  Objects that do not split the work fill everything in Hit and  *
+* have nothing left to do there.                                           *
+*                                                                          *
+* Split is used by the spatial split BVH builder: it cuts the part of the  *
+* object inside a box with an axis-aligned plane and returns the bounds of *
+* the two halves.  Objects that do not know better just cut the box.       *
+*                                                                          *
+* Hash folds what the object is into a hash of the scene, which identifies *
+* the objects an acceleration structure was cached for (see Cache.h).  By  *
+* default that is its type and its bounds; objects whose bounds do not     *
+* pin down their geometry hash that too.                                   *
+*                                                                          *
+* Area and GetNormalCone describe an emitter to the light tree, which uses *
+* them to guess how much light it sends towards a point.                   *
+*                                                                          *
 *                                                                          *
 ***************************************************************************/
 
@@ -27,14 +55,21 @@
 class Object	// This encodes all objects that are ray traced.
 {
 	public:
-		Material material;
-		Object  *next;
+		unsigned int material_id;	// Index of its material in the MaterialTable of the scene.
+		Object      *next;
 		
 		Object();
 		virtual ~Object(){}
 		virtual bool Intersect( const Ray &ray, HitGeom &hitgeom ) const = 0;
+		virtual bool Occludes( const Ray &ray, double max_distance ) const;
+		virtual const Object *Hit( const Ray &ray, HitGeom &hitgeom ) const;
+		virtual void GetHitAttributes( const Ray &/*ray*/, HitGeom &/*hitgeom*/ ) const {}
 		virtual Box3 GetBounds() const = 0;
+		virtual void Split( const Box3 &box, int axis, double position, Box3 &left, Box3 &right ) const;
 		virtual Sample GetSample( const Vec3 &P, const Vec3 &N ) const {return Sample();}
+		virtual double Area() const;
+		virtual void GetNormalCone( Vec3 &axis, double &spread ) const;
+		virtual unsigned long long Hash( unsigned long long hash ) const;
 		
 };
 
@@ -0,0 +1,76 @@
+#include "PerfCounters.h"
+
+#if defined( __linux__ )
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Opens a counter of read misses of the given cache for this thread, user
+// space only, stopped until Start.
+static int OpenCacheMisses( unsigned long long cache )
+{
+	struct perf_event_attr attr;
+	memset( &attr, 0, sizeof( attr ) );
+	attr.size           = sizeof( attr );
+	attr.type           = PERF_TYPE_HW_CACHE;
+	attr.config         = cache | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+	attr.disabled       = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv     = 1;
+	return (int)syscall( __NR_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+static long long ReadCounter( int fd )
+{
+	long long value = 0;
+	if( fd < 0 || read( fd, &value, sizeof( value ) ) != sizeof( value ) ) return -1;
+	return value;
+}
+
+CacheCounters::CacheCounters()
+{
+	l1_misses = llc_misses = -1;
+	l1_fd  = OpenCacheMisses( PERF_COUNT_HW_CACHE_L1D );
+	llc_fd = OpenCacheMisses( PERF_COUNT_HW_CACHE_LL );
+}
+
+CacheCounters::~CacheCounters()
+{
+	if( l1_fd >= 0 ) close( l1_fd );
+	if( llc_fd >= 0 ) close( llc_fd );
+}
+
+void CacheCounters::Start()
+{
+	if( !Available() ) return;
+	ioctl( l1_fd, PERF_EVENT_IOC_RESET, 0 );
+	ioctl( llc_fd, PERF_EVENT_IOC_RESET, 0 );
+	ioctl( l1_fd, PERF_EVENT_IOC_ENABLE, 0 );
+	ioctl( llc_fd, PERF_EVENT_IOC_ENABLE, 0 );
+}
+
+void CacheCounters::Stop()
+{
+	if( !Available() ) return;
+	ioctl( l1_fd, PERF_EVENT_IOC_DISABLE, 0 );
+	ioctl( llc_fd, PERF_EVENT_IOC_DISABLE, 0 );
+	l1_misses  = ReadCounter( l1_fd );
+	llc_misses = ReadCounter( llc_fd );
+}
+
+#else
+
+CacheCounters::CacheCounters()
+{
+	l1_misses = llc_misses = -1;
+	l1_fd = llc_fd = -1;
+}
+
+CacheCounters::~CacheCounters() {}
+void CacheCounters::Start() {}
+void CacheCounters::Stop() {}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines a reader of the hardware counters of the data cache    *
+* misses of the calling thread: misses of the level 1 data cache and of    *
+* the last level cache.  They come from the perf_event interface of Linux; *
+* on other systems, or where the kernel does not allow it, the counters    *
+* are simply reported as not available.                                    *
+*                                                                          *
+***************************************************************************/
+
+class CacheCounters // Counts the cache misses between Start and Stop.
+{
+	public:
+		long long l1_misses;	// Level 1 data cache read misses.
+		long long llc_misses;	// Last level cache read misses.
+
+		CacheCounters();
+		~CacheCounters();
+
+		bool Available() const { return l1_fd >= 0 && llc_fd >= 0; }
+		void Start();
+		void Stop();
+
+	private:
+		int l1_fd;	// perf_event file descriptors, -1 if the counter could not be opened.
+		int llc_fd;
+};
+
+#endif
\ No newline at end of file
@@ -1,10 +1,17 @@
 #include "Polygon.h"
+#include "Triangle.h"
 
 //=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~//
 // Polygon object.                                                        //
 //                                                                        //
 // The polygon object is defined by 5 vertices in R3.  This is a          //
 // simple flat polygon.                                                   //
+//                                                                        //
+// When it is built, the polygon is cut into three triangles by clipping  //
+// ears from its outline, projected onto the plane of its dominant axis,  //
+// so concave pentagons work as well as convex ones.  A ray is tested     //
+// against the triangles with the watertight test, so it cannot slip      //
+// through the diagonals between them.                                    //
 //=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~//
 
 Polygon::Polygon( const Vec3 &A_, const Vec3 &B_, const Vec3 &C_, const Vec3 &D_, const Vec3 &E_ )
@@ -17,10 +24,14 @@ Polygon::Polygon( const Vec3 &A_, const Vec3 &B_, const Vec3 &C_, const Vec3 &D_
 	D = D_;
 	E = E_;
 
-	// Compute the normal to plane of the triangle
-	// Cross product between two vectors created by points fo the triangle
-
-    N = Unit( ( C - B ) ^ ( A - B ) );
+	// Compute the normal to plane of the polygon with Newell's method,
+	// which uses all the corners, so it does not matter if some of them
+	// are in line or the polygon is concave.
+	const Vec3 *corner[5] = { &A, &B, &C, &D, &E };
+	N = Vec3( 0.0, 0.0, 0.0 );
+	for( int i = 0; i < 5; i++ )
+		N = N + ( *corner[i] ^ *corner[( i + 1 ) % 5] );
+	N = Unit( N );
 
 	// Compute the distance from origin to plane of triangle.
 	// This equals to D on the plane coordinates
@@ -62,6 +73,8 @@ Polygon::Polygon( const Vec3 &A_, const Vec3 &B_, const Vec3 &C_, const Vec3 &D_
 	if( E.z < box.Z.min ) box.Z.min = E.z;
 	else if( E.z > box.Z.max ) box.Z.max = E.z;
 
+	Triangulate();
+
     next = NULL;
     }
 
@@ -79,7 +92,166 @@ Box3 Polygon::GetBounds() const // Return pre-computed box.
     return box;
     }
 
+// Twice the signed area of the triangle P, Q, R projected onto the axes u
+// and v, positive if it turns counterclockwise.
+static double Turn( const Vec3 &P, const Vec3 &Q, const Vec3 &R, int u, int v )
+{
+	return ( Component( Q, u ) - Component( P, u ) ) * ( Component( R, v ) - Component( P, v ) ) -
+		   ( Component( Q, v ) - Component( P, v ) ) * ( Component( R, u ) - Component( P, u ) );
+}
+
+// Cuts the polygon into triangles, each made of three consecutive corners
+// of what is left of it whose middle one is convex and has no other corner
+// inside the triangle (an ear), until three corners are left.  The test is
+// done on the plane of the dominant axis of the normal, with the turns
+// signed so that the polygon runs counterclockwise.
+void Polygon::Triangulate()
+{
+	const Vec3 *corner[5] = { &A, &B, &C, &D, &E };
+	int left[5] = { 0, 1, 2, 3, 4 };
+	int n = 5;
+	int count = 0;
+
+	double nx = fabs( N.x ), ny = fabs( N.y ), nz = fabs( N.z );
+	int w = nx > ny ? ( nx > nz ? 0 : 2 ) : ( ny > nz ? 1 : 2 );
+	int u = ( w + 1 ) % 3;
+	int v = ( w + 2 ) % 3;
+	double sign = Component( N, w ) < 0.0 ? -1.0 : 1.0;
+
+	while( n > 3 )
+	{
+		int ear = 0;	// A flat or broken outline has no ear; then the fan around left[0] is used.
+		for( int i = 0; i < n; i++ )
+		{
+			const Vec3 &P = *corner[left[( i + n - 1 ) % n]];
+			const Vec3 &Q = *corner[left[i]];
+			const Vec3 &R = *corner[left[( i + 1 ) % n]];
+			if( sign * Turn( P, Q, R, u, v ) <= 0.0 ) continue;
+
+			bool empty = true;
+			for( int j = 0; j < n && empty; j++ )
+			{
+				const Vec3 &X = *corner[left[j]];
+				if( &X == &P || &X == &Q || &X == &R ) continue;
+				empty = !( sign * Turn( P, Q, X, u, v ) >= 0.0 && sign * Turn( Q, R, X, u, v ) >= 0.0 && sign * Turn( R, P, X, u, v ) >= 0.0 );
+			}
+			if( empty )
+			{
+				ear = i;
+				break;
+			}
+		}
+
+		T[count][0] = *corner[left[( ear + n - 1 ) % n]];
+		T[count][1] = *corner[left[ear]];
+		T[count][2] = *corner[left[( ear + 1 ) % n]];
+		count++;
+		for( int i = ear; i < n - 1; i++ ) left[i] = left[i + 1];
+		n--;
+	}
+	for( int k = 0; k < 3; k++ ) T[count][k] = *corner[left[k]];
+
+	area = 0.0;
+	for( int i = 0; i < 3; i++ )
+	{
+		tri_area[i] = 0.5 * Length( ( T[i][1] - T[i][0] ) ^ ( T[i][2] - T[i][0] ) );
+		area += tri_area[i];
+	}
+}
+
 bool Polygon::Intersect( const Ray &ray, HitGeom &hitgeom ) const
-    {
+{
+	if( Hit( ray, hitgeom ) == NULL ) return false;
+	GetHitAttributes( ray, hitgeom );
+	return true;
+}
+
+// The triangles share the plane of the polygon, so the first one hit is
+// the closest.
+const Object *Polygon::Hit( const Ray &ray, HitGeom &hitgeom ) const
+{
+	double t;
+
+	for( int i = 0; i < 3; i++ )
+	{
+		if( HitWatertight( ray, T[i][0], T[i][1], T[i][2], hitgeom.distance, t ) )
+		{
+			hitgeom.distance = Scalar( t );
+			hitgeom.part     = i;
+			hitgeom.object   = this;
+			return this;
+		}
+	}
+	return NULL;
+}
+
+void Polygon::GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const
+{
+	hitgeom.normal = N;
+	hitgeom.origin = ray.origin;
+	hitgeom.point  = ray.origin + hitgeom.distance * ray.direction;
+}
+
+bool Polygon::Occludes( const Ray &ray, double max_distance ) const
+{
+	double t;
+
+	for( int i = 0; i < 3; i++ )
+	{
+		if( HitWatertight( ray, T[i][0], T[i][1], T[i][2], max_distance, t ) ) return true;
+	}
 	return false;
-	}
\ No newline at end of file
+}
+
+unsigned long long Polygon::Hash( unsigned long long hash ) const
+{
+	const Vec3 *corner[5] = { &A, &B, &C, &D, &E };
+
+	hash = Object::Hash( hash );
+	for( int i = 0; i < 5; i++ ) hash = HashBytes( hash, corner[i], sizeof( Vec3 ) );
+	return hash;
+}
+
+double Polygon::Area() const
+{
+	return area;
+}
+
+// A flat polygon has a single normal.
+void Polygon::GetNormalCone( Vec3 &axis, double &spread ) const
+{
+	axis = N;
+	spread = 0.0;
+}
+
+// Picks one of the triangles with a probability proportional to its area,
+// and a point on it as Triangle::GetSample does.  The weight is that of the
+// whole polygon seen from P through the point.
+Sample Polygon::GetSample( const Vec3 &P, const Vec3 &N_point ) const
+{
+	Sample sample;
+
+	sample.P = P;
+	sample.w = 0.0;
+	if( area <= 0.0 ) return sample;
+
+	double r = rand( 0.0, area );
+	int i = 0;
+	while( i < 2 && r >= tri_area[i] )
+	{
+		r -= tri_area[i];
+		i++;
+	}
+
+	double s = sqrt( rand( 0.0, 1.0 ) );
+	double t = rand( 0.0, 1.0 );
+	sample.P = ( 1 - s ) * T[i][0] + ( s * ( 1 - t ) ) * T[i][1] + ( s * t ) * T[i][2];
+
+	double rsqr = LengthSquared( sample.P - P );
+	if( rsqr <= 0.0 ) return sample;
+
+	double cos_theta = fabs( N * Unit( P - sample.P ) );
+	sample.w = Scalar( area * cos_theta / rsqr );
+	if( sample.w > TwoPi ) sample.w = Scalar( TwoPi );
+	return sample;
+}
\ No newline at end of file
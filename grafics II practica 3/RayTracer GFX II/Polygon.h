@@ -12,11 +12,24 @@ class Polygon : public Object
 		double d;     // Distance from origin to plane of polygon.
 		Box3   box;   // Bounding box;
 		Vec3 A, B, C, D, E; // Corners of the polygon
+		Vec3   T[3][3];     // Corners of the three triangles the polygon is cut into.
+		double tri_area[3]; // Area of each of them.
+		double area;        // Area of the polygon.
 
 		Polygon( const Vec3 &A, const Vec3 &B, const Vec3 &C , const Vec3 &D , const Vec3 &E );
 		bool Intersect( const Ray &ray, HitGeom &hitgeom ) const;
+		bool Occludes( const Ray &ray, double max_distance ) const;
+		const Object *Hit( const Ray &ray, HitGeom &hitgeom ) const;
+		void GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const;
 		Box3 GetBounds() const;
+		unsigned long long Hash( unsigned long long hash ) const;
 		static Object *ReadString( const char *params );
+		Sample GetSample( const Vec3 &P, const Vec3 &N_point ) const;
+		double Area() const;
+		void GetNormalCone( Vec3 &axis, double &spread ) const;
+
+	private:
+		void Triangulate();
 };
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "Primitives.h"
+
+void Primitives::Compile( const std::vector<Object*> &objects )
+{
+	refs.resize( objects.size() );
+	spheres.clear();
+	cubes.clear();
+	triangles.clear();
+	others.clear();
+
+	for( size_t i = 0; i < objects.size(); i++ )
+	{
+		const Object *object = objects[i];
+
+		if( const Sphere *sphere = dynamic_cast<const Sphere*>( object ) )
+		{
+			SpherePrimitive p;
+			p.center = sphere->center;
+			p.radius = sphere->radius;
+			p.object = object;
+			refs[i] = (int)spheres.size() << 2 | PRIMITIVE_SPHERE;
+			spheres.push_back( p );
+		}
+		else if( const Cube *cube = dynamic_cast<const Cube*>( object ) )
+		{
+			CubePrimitive p;
+			p.Min = cube->Min;
+			p.Max = cube->Max;
+			p.object = object;
+			refs[i] = (int)cubes.size() << 2 | PRIMITIVE_CUBE;
+			cubes.push_back( p );
+		}
+		else if( const Triangle *triangle = dynamic_cast<const Triangle*>( object ) )
+		{
+			TrianglePrimitive p;
+			p.A = triangle->A;
+			p.B = triangle->B;
+			p.C = triangle->C;
+			p.E1 = triangle->E1;
+			p.E2 = triangle->E2;
+			p.object = object;
+			refs[i] = (int)triangles.size() << 2 | PRIMITIVE_TRIANGLE;
+			triangles.push_back( p );
+		}
+		else
+		{
+			refs[i] = (int)others.size() << 2 | PRIMITIVE_OBJECT;
+			others.push_back( object );
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines the compiled form of the objects an accelerator holds. *
+* The scene is read as a linked list of Objects, each tested through its   *
+* virtual Intersect, which the compiler cannot inline and which sends      *
+* every test to wherever that object was allocated.  Once a structure has  *
+* put its objects in the order of its leaves, it compiles them: spheres,   *
+* cubes and triangles are copied, in that order, into arrays of their own  *
+* that keep only what the intersection needs, and every leaf slot becomes  *
+* a reference that tags the array and gives the index in it.  A leaf then  *
+* picks the test with a switch on the tag and calls it directly, and the   *
+* primitives of a leaf sit next to each other in memory.                   *
+*                                                                          *
+* Any other kind of object (polygons, meshes, instances) is kept as it is  *
+* and still tested through its virtual methods.  So are triangles while    *
+* the barycentric kernel is chosen, since it needs the whole Triangle.     *
+* The Objects remain what the parser builds, what light sampling uses, and *
+* what a hit returns so that its material can be found.                    *
+*                                                                          *
+* The arrays hold copies of the geometry, so they must be compiled again   *
+* whenever the objects move, which the accelerators do when they refit.    *
+*                                                                          *
+***************************************************************************/
+
+#include <vector>
+
+#include "Sphere.h"
+#include "Cube.h"
+#include "Triangle.h"
+
+enum PrimitiveType // Array a reference points into.
+{
+	PRIMITIVE_SPHERE,
+	PRIMITIVE_CUBE,
+	PRIMITIVE_TRIANGLE,
+	PRIMITIVE_OBJECT	// Anything else, tested through Object::Hit and Object::Occludes.
+};
+
+class SpherePrimitive
+{
+	public:
+		Vec3          center;
+		float         radius;
+		const Object *object;	// The Sphere it was compiled from.
+};
+
+class CubePrimitive
+{
+	public:
+		Vec3          Min, Max;
+		const Object *object;
+};
+
+class TrianglePrimitive
+{
+	public:
+		Vec3          A, B, C;	// Corners, for the watertight test.
+		Vec3          E1, E2;	// Edges B - A and C - A, for Moller-Trumbore.
+		const Object *object;
+};
+
+class Primitives
+{
+	public:
+		// Builds the arrays for the objects of the leaves, in this order:
+		// slot i of the result stands for objects[i].
+		void Compile( const std::vector<Object*> &objects );
+
+		// Intersects the primitive of a slot, as Object::Hit does, unless it
+		// comes from "ignore".  Like Hit, it only records the distance and
+		// the object, whose GetHitAttributes gives the rest.
+		const Object *Hit( int slot, const Ray &ray, HitGeom &hitgeom, const Object *ignore ) const;
+
+		// Returns true if the primitive of a slot, unless it comes from
+		// "ignore", blocks the ray closer than max_distance.
+		bool Occludes( int slot, const Ray &ray, double max_distance, const Object *ignore ) const;
+
+		int NumSlots() const { return (int)refs.size(); }
+
+	private:
+		std::vector<int>               refs;	// A PrimitiveType in the low two bits, the index in its array above.
+		std::vector<SpherePrimitive>   spheres;
+		std::vector<CubePrimitive>     cubes;
+		std::vector<TrianglePrimitive> triangles;
+		std::vector<const Object*>     others;
+};
+
+inline const Object *Primitives::Hit( int slot, const Ray &ray, HitGeom &hitgeom, const Object *ignore ) const
+{
+	int ref = refs[slot];
+	int index = ref >> 2;
+	const Object *object;
+	double t;
+	int face;
+
+	switch( ref & 3 )
+	{
+		case PRIMITIVE_SPHERE:
+		{
+			const SpherePrimitive &sphere = spheres[index];
+			if( sphere.object == ignore || !HitSphere( ray, sphere.center, sphere.radius, hitgeom.distance, t ) ) return NULL;
+			object = sphere.object;
+			break;
+		}
+		case PRIMITIVE_CUBE:
+		{
+			const CubePrimitive &cube = cubes[index];
+			if( cube.object == ignore || !HitCube( ray, cube.Min, cube.Max, hitgeom.distance, t, face ) ) return NULL;
+			hitgeom.part = face;
+			object = cube.object;
+			break;
+		}
+		case PRIMITIVE_TRIANGLE:
+		{
+			const TrianglePrimitive &triangle = triangles[index];
+			if( triangle.object == ignore ) return NULL;
+			if( Triangle::kernel == TRIANGLE_BARYCENTRIC ) return triangle.object->Hit( ray, hitgeom );
+			if( !HitTriangle( ray, triangle.A, triangle.B, triangle.C, triangle.E1, triangle.E2, hitgeom.distance, t ) ) return NULL;
+			object = triangle.object;
+			break;
+		}
+		default:
+		{
+			object = others[index];
+			return object == ignore ? NULL : object->Hit( ray, hitgeom );
+		}
+	}
+
+	hitgeom.distance = Scalar( t );
+	hitgeom.object   = object;
+	return object;
+}
+
+inline bool Primitives::Occludes( int slot, const Ray &ray, double max_distance, const Object *ignore ) const
+{
+	int ref = refs[slot];
+	int index = ref >> 2;
+
+	switch( ref & 3 )
+	{
+		case PRIMITIVE_SPHERE:
+		{
+			const SpherePrimitive &sphere = spheres[index];
+			return sphere.object != ignore && OccludesSphere( ray, sphere.center, sphere.radius, max_distance );
+		}
+		case PRIMITIVE_CUBE:
+		{
+			const CubePrimitive &cube = cubes[index];
+			return cube.object != ignore && OccludesCube( ray, cube.Min, cube.Max, max_distance );
+		}
+		case PRIMITIVE_TRIANGLE:
+		{
+			const TrianglePrimitive &triangle = triangles[index];
+			if( triangle.object == ignore ) return false;
+			if( Triangle::kernel == TRIANGLE_BARYCENTRIC ) return triangle.object->Occludes( ray, max_distance );
+			return OccludesTriangle( ray, triangle.A, triangle.B, triangle.C, triangle.E1, triangle.E2, max_distance );
+		}
+		default:
+		{
+			const Object *object = others[index];
+			return object != ignore && object->Occludes( ray, max_distance );
+		}
+	}
+}
+
+#endif
\ No newline at end of file
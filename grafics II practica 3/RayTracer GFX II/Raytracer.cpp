@@ -15,8 +15,15 @@ static const int tree_depth = 1;		// Number of recursions to compute indirect il
 
 static const int rays_pixel = 50;
 
+static const int light_samples = 1;		// Lights sampled for the direct illumination of each point
+
 #include "Raytracer.h"
 
+// How the accelerator is walked for each kind of ray: camera, indirect and
+// shadow rays.  Rays from the eye are the ones cast in large coherent
+// batches, and can go without a stack.
+static const Traversal traversal[NUM_RAY_KINDS] = { TRAVERSAL_STACKLESS, TRAVERSAL_STACK, TRAVERSAL_STACK };
+
 // Draw image on the screen
 void Raytracer::draw( void )
 {
@@ -40,6 +47,7 @@ void Raytracer::cast_line( World world )
     Vec3 dU = U * ( 2.0 / ( resolutionY - 1 ) );						// Up increments.
 	Vec3 dR = R * ( 2.0 / ( resolutionX - 1 ) );						// Right increments.
 
+    if( currentLine == 0 ) startTime = clock();
     if( currentLine % 10 == 0 ) cout << "line " << currentLine << endl;
     for( int i = 0; i < resolutionX; i++ )
     {
@@ -47,7 +55,7 @@ void Raytracer::cast_line( World world )
 		{
 			// One ray per pixel
 			ray.direction = Unit( O + i * dR - currentLine * dU  );
-			color = Trace( ray, world.getScene(), tree_depth );
+			color = Trace( ray, world.getScene(), tree_depth, CAMERA_RAY );
 		}
 		else
 		{
@@ -55,7 +63,7 @@ void Raytracer::cast_line( World world )
 			for( int n = 0 ; n < rays_pixel ; n++ )
 			{
 				ray.direction = Unit( O + ( i + rand( 0.0 , 1.0 ) - 0.5 ) * dR - ( currentLine + rand( 0.0 , 1.0 ) - 0.5 ) * dU  );
-				color += Trace( ray, world.getScene(), tree_depth );
+				color += Trace( ray, world.getScene(), tree_depth, CAMERA_RAY );
 			}
 		}
 		(*I)( resolutionY-currentLine-1, i ) = ToneMap( color / rays_pixel );
@@ -68,8 +76,10 @@ void Raytracer::cast_line( World world )
 	if (++currentLine == resolutionY)
 	{
 		// Image computation done, save it to file
-		cout << "done." << endl;
+		double seconds = double( clock() - startTime ) / CLOCKS_PER_SEC;
+		cout << "done in " << seconds << " s." << endl;
 	    I->Write( "Resultat.ppm" );
+		if( !stats.Write( "Resultat.json", *world.getScene().accel, seconds ) ) cerr << "Could not write Resultat.json" << endl;
 		isDone = true;
 	}
 }
@@ -98,7 +108,7 @@ Pixel Raytracer::ToneMap( const Color &color )
 // trace may again be called as a result of the ray hitting a reflecting
 // object.  To prevent the possibility of infinite recursion, a maximum
 // depth is placed on the resulting ray tree.
-Color Raytracer::Trace( const Ray &ray, const Scene &scene, int max_tree_depth  )
+Color Raytracer::Trace( const Ray &ray, const Scene &scene, int max_tree_depth, RayKind kind )
 {
     Color   color;                    // The color to return.
     HitInfo hitinfo;                  // Holds info to pass to shader.
@@ -106,14 +116,14 @@ Color Raytracer::Trace( const Ray &ray, const Scene &scene, int max_tree_depth
 	// Intitallizes hit distance to infinity to allow finding intersections in all ray length
 	hitinfo.geom.distance = Infinity;
 
-	if (Cast( ray, scene, hitinfo ) > 0.0f && max_tree_depth > -1 )
+	if (Cast( ray, scene, hitinfo, NULL, kind ) > 0.0f && max_tree_depth > -1 )
 	{
         // The ray hits an object, so shade the point that the ray hit.
         // Cast has put all necessary information for Shade in "hitinfo".
 		
 		// If the ray has no_emitters activated and the first hit is an emitter
 		//  this ray shouldn't contribute to the color of the current pixel
-		if( hitinfo.material.Emitter() && ray.no_emitters == true ) color = Color ();
+		if( (*scene.materials)[hitinfo.material_id].Emitter() && ray.no_emitters == true ) color = Color ();
 
 		// The ray hits an object, so shade the point that the ray hit.
         // Cast has put all necessary information for Shade in "hitinfo".
@@ -133,33 +143,32 @@ Color Raytracer::Trace( const Ray &ray, const Scene &scene, int max_tree_depth
 // between a ray and a list of geometric objects.  If no intersection
 // exists, the function returns false.  Information about the
 // closest object hit is returned in "hitinfo". 
-int Raytracer::Cast( const Ray &ray, const Scene &scene, HitInfo &hitinfo, Object *ignore )
+int Raytracer::Cast( const Ray &ray, const Scene &scene, HitInfo &hitinfo, Object *ignore, RayKind kind )
 {
-	int hit = false;
-
     // Each intersector is ONLY allowed to write into the "HitGeom"
     // structure if it has determined that the ray hits the object
     // at a CLOSER distance than currently recorded in HitGeom.distance.
-    // When a closer hit is found, the material fields of the "HitInfo"
-    // structure are updated to hold the material of the object that 
-    // was just hit.
-
-    for( Object *object = scene.first; object != NULL; object = object->next )
-    {
-        if( object != ignore && object->Intersect( ray, hitinfo.geom ) )
-            {
-            hitinfo.material = object->material;  // Material of closest surface.
-            hit = true;                           // We have hit an object.
-            }
-    }
-    return hit;
+    // The hierarchy only tests the objects whose boxes the ray crosses
+    // and returns the closest one, of which only the distance is known.
+    // Its point and normal are then worked out, and the index of its
+    // material put into the "HitInfo" structure.
+
+    QueryCounters start = query_counters;
+    const Object *object = scene.accel->Intersect( ray, hitinfo.geom, ignore, traversal[kind] );
+    stats.Add( kind, start );
+    if( object == NULL ) return false;
+
+    hitinfo.geom.object->GetHitAttributes( ray, hitinfo.geom );
+    hitinfo.material_id = object->material_id;  // Material of closest surface.
+    return true;
 }
 
 Color Raytracer::Shade( const HitInfo &hit, const Scene &scene, int max_tree_depth )
 {
+	const Material &material = (*scene.materials)[hit.material_id];
 	Color color_final;
-	if (hit.material.Emitter()) {
-		return hit.material.m_Diffuse;
+	if (material.Emitter()) {
+		return material.m_Diffuse;
 	}
 	Vec3 N = hit.geom.normal;
 	Ray shadows;
@@ -194,49 +203,52 @@ Color Raytracer::Shade( const HitInfo &hit, const Scene &scene, int max_tree_dep
 
 
 	double u = rand(0, 1);
-	float contriS = (hit.material.m_Specular.blue + hit.material.m_Specular.red + hit.material.m_Specular.green) / 3;
-	float contriD = (hit.material.m_Diffuse.blue + hit.material.m_Diffuse.red + hit.material.m_Diffuse.green) / 3;
+	float contriS = material.m_SpecularWeight;
+	float contriD = material.m_DiffuseWeight;
 	Vec3 V = Unit(hit.geom.point - hit.geom.origin);
 
-	for (Object *object = scene.first; object != NULL; object = object->next){
-		
-		
-		if ((object->material.Emitter()) && cdirect) {
+	// The light tree picks the lights to sample, in proportion to how much
+	// each one can send here, and every sample is divided by the probability
+	// of its light so that the estimate stays the same on average.
+	for (int l = 0; l < light_samples && cdirect; l++){
 
-			Sample S = object->GetSample(hit.geom.point, hit.geom.normal);
-			
-			shadows.direction = Unit(S.P - hit.geom.point);
+		double probability;
+		const Object *object = scene.lights->Pick(hit.geom.point, hit.geom.normal, probability);
+		if (object == NULL) break;
 
-			HitInfo vacio;
-			vacio.geom.distance = Length(S.P - hit.geom.point);
-
-			if (Cast(shadows, scene, vacio, object)) {
-				continue;
-			}
+		Sample S = object->GetSample(hit.geom.point, hit.geom.normal);
+		
+		shadows.direction = Unit(S.P - hit.geom.point);
 
-			//ts.direction = S.P - hit.geom.point;
+		// The light is not visible if anything but itself lies in between
+		QueryCounters start = query_counters;
+		bool occluded = scene.accel->Occluded(shadows, Length(S.P - hit.geom.point), object, traversal[SHADOW_RAY]);
+		stats.Add(SHADOW_RAY, start);
+		if (occluded) {
+			continue;
+		}
 
-			Vec3 L = Unit(S.P - hit.geom.point);
-			Vec3 R = Reflection(L, N);
+		//ts.direction = S.P - hit.geom.point;
 
-			float NL = N*L;
-			if (NL < 0) {
-				NL = 0;
-			}
-			diffuse = NL * hit.material.m_Diffuse;
+		Vec3 L = Unit(S.P - hit.geom.point);
+		Vec3 R = Reflection(L, N);
 
-			float RV = R*V;
-			if (RV > 0 && hit.material.m_Phong_exp > 0) {
-				specular = pow(RV, hit.material.m_Phong_exp) * hit.material.m_Specular;
-			}
-			
-			Color irradiance = S.w*object->material.m_Emission;
-
-			direct += (diffuse + specular) * irradiance;
+		float NL = N*L;
+		if (NL < 0) {
+			NL = 0;
+		}
+		diffuse = NL * material.m_Diffuse;
 
+		float RV = R*V;
+		if (RV > 0 && material.m_Phong_exp > 0) {
+			specular = pow(RV, material.m_Phong_exp) * material.m_Specular;
 		}
 		
+		Color irradiance = S.w*(*scene.materials)[object->material_id].m_Emission;
+
+		direct += (diffuse + specular) * irradiance / (probability * light_samples);
 	}
+
 	Color indirect;
 	if ((contriD + contriS) > u) {
 		Sample S1 = SampleProjectedHemisphere(N);
@@ -246,20 +258,20 @@ Color Raytracer::Shade( const HitInfo &hit, const Scene &scene, int max_tree_dep
 		rayo.direction = S1.P;
 		Color indirect_diff;
 		if ((u < contriD)) {
-			indirect_diff = S1.w * hit.material.m_Diffuse / Pi * Trace(rayo, scene, num_reb);
+			indirect_diff = S1.w * material.m_Diffuse / Pi * Trace(rayo, scene, num_reb, INDIRECT_RAY);
 		}
 
 		Color indirect_spec;
 
 		Sample S2;
-		if ((hit.material.m_Phong_exp > 0) && (contriD <= u < (contriD + contriS))) {
+		if ((material.m_Phong_exp > 0) && (contriD <= u < (contriD + contriS))) {
 			Ray rayo1;
 			Vec3 ref = Reflection(V, N);
 			rayo1.no_emitters = false;
 			rayo1.origin = hit.geom.point + Epsilon*N;
-			S2 = SampleSpecularLobe(ref, hit.material.m_Phong_exp);
+			S2 = SampleSpecularLobe(ref, material.m_Phong_exp);
 			rayo1.direction = S2.P;
-			indirect_spec = S2.w*hit.material.m_Specular*((hit.material.m_Phong_exp + 2) / (2 * Pi))*Trace(rayo1, scene, num_reb);
+			indirect_spec = S2.w*material.m_Specular*material.m_PhongNorm*Trace(rayo1, scene, num_reb, INDIRECT_RAY);
 		}
 
 
@@ -283,17 +295,17 @@ Sample Raytracer::SampleProjectedHemisphere( const Vec3 &N )
 	Vec3 v(0.0,0.0,1.0);
 	
 	//weight of sample - according to PDF equations, this is Pi for a hemisphere
-	sample.w = Pi;
+	sample.w = Scalar( Pi );
 	
 	//random values for s and t in parameter space
 	s_rand = rand(0.0,1.0);
 	t_rand = rand(0.0,1.0);
 	
 	//Projection upwards to hemisphere
-	aux.x = sqrt(t_rand)*cos(2.0*Pi*s_rand);
-	aux.y = sqrt(t_rand)*sin(2.0*Pi*s_rand);
-	aux.z = 1.0 - pow(aux.x , 2.0) - pow(aux.y , 2.0);
-	aux.z = (aux.z > 0.0) ? sqrt(aux.z) : 0.0;
+	aux.x = Scalar(sqrt(t_rand)*cos(2.0*Pi*s_rand));
+	aux.y = Scalar(sqrt(t_rand)*sin(2.0*Pi*s_rand));
+	aux.z = Scalar(1.0 - pow(aux.x , 2.0) - pow(aux.y , 2.0));
+	aux.z = (aux.z > 0.0) ? Scalar(sqrt(aux.z)) : Scalar(0.0);
 
 	//Now convert to correct space (i.e. around normal)
 	aux_mig = Unit(v + N);
@@ -326,16 +338,16 @@ Sample Raytracer::SampleSpecularLobe( const Vec3 &R, float phong_exp  )
 	e= 2.0/(phong_exp+1.0);
 	spri = sqrt(1.0-pow(s,e));
 
-	final.P.x = spri* cos(2.0*Pi*t); 
-	final.P.y = spri* sin(2.0*Pi*t); 
-	final.P.z = sqrt(1.0 - pow(final.P.x , 2.0) - pow(final.P.y , 2.0));
+	final.P.x = Scalar(spri* cos(2.0*Pi*t)); 
+	final.P.y = Scalar(spri* sin(2.0*Pi*t)); 
+	final.P.z = Scalar(sqrt(1.0 - pow(final.P.x , 2.0) - pow(final.P.y , 2.0)));
 
 	aux_mig = (v + R)/Length(v +R);
 
 	//Calculate final vector
 	final.P = Reflection(-final.P, aux_mig);
 	//Don't forget the weight
-	final.w = (2.0*Pi)/(phong_exp+2.0);
+	final.w = Scalar((2.0*Pi)/(phong_exp+2.0));
 
 	//Retornem la mostra.
 	return final;
@@ -26,6 +26,7 @@
 #include "World.h"
 
 #include <GL/glut.h>
+#include <time.h>
 
 class Raytracer
 {
@@ -34,6 +35,8 @@ class Raytracer
 	int		resolutionY;
 	int		currentLine;
 	bool	isDone;
+	clock_t	startTime;	// When the first line was cast
+	RenderStats stats;	// Work done by the rays cast so far
 
 	public:
 		Raytracer( int x, int y )
@@ -61,7 +64,8 @@ class Raytracer
 		Color Trace(						// What color do I see looking along this ray?
 					const Ray   &ray,       // Root of ray tree to recursively trace in scene.
 					const Scene &scene,		// Global scene description, including lights.
-					int max_tree_depth		// Limit to depth of the ray tree.
+					int max_tree_depth,		// Limit to depth of the ray tree.
+					RayKind kind = INDIRECT_RAY	// What the ray is cast for.
 		);
 
 		Color Shade(						// Surface shader.
@@ -80,14 +84,15 @@ class Raytracer
 					const Ray   &ray,       // The ray to cast into the scene.
 					const Scene &scene,     // Global scene description, including lights.
 					HitInfo     &hitinfo,    // All information about ray-object intersection.
-					Object		*ignore	 = false  // Object that will be ignored for the intersection
+					Object		*ignore	 = NULL,   // Object that will be ignored for the intersection
+					RayKind		kind = INDIRECT_RAY	// What the ray is cast for.
 		);
 
 		int Cast2(							// Casts a single ray to see what it hits.
 					const Ray   &ray,       // The ray to cast into the scene.
 					const Scene &scene,     // Global scene description, including lights.
 					HitInfo     &hitinfo,    // All information about ray-object intersection.
-					Object		*ignore	 = false  // Object that will be ignored for the intersection
+					Object		*ignore	 = NULL   // Object that will be ignored for the intersection
 		);
 
 		Sample SampleProjectedHemisphere(
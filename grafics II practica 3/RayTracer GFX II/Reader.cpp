@@ -1,15 +1,24 @@
 	#include "Reader.h"
 
+#include <string.h>
+
+// The values are read as doubles whatever the precision of Vec3 and Color.
 bool Reader::Get( const char *line, const char *name, Vec3 &coord )
 {
+	double x, y, z;
 	sprintf( format, "%s (%%lf,%%lf,%%lf)", name );
-	return sscanf( line, format, &coord.x, &coord.y, &coord.z ) == 3;
+	if( sscanf( line, format, &x, &y, &z ) != 3 ) return false;
+	coord = Vec3( x, y, z );
+	return true;
 }
 
 bool Reader::Get( const char *line, const char *name, Color &color )
 {
+	double r, g, b;
 	sprintf( format, "%s [%%lf,%%lf,%%lf]", name );
-	return sscanf( line, format, &color.red, &color.green, &color.blue ) == 3;
+	if( sscanf( line, format, &r, &g, &b ) != 3 ) return false;
+	color = Color( r, g, b );
+	return true;
 }
 
 bool Reader::Get( const char *line, const char *name, float &value )
@@ -29,6 +38,31 @@ bool Reader::Blank( char *line )
 	return true;
 }
 
+// Reads an instance line.  Returns the new instance, or NULL if the line is
+// not an instance or names an unknown group.
+Object *Reader::ReadInstance( const char *line )
+{
+	char name[64];
+	double t[3] = { 0.0, 0.0, 0.0 };	// Translation, rotation and scale.
+	double r[3] = { 0.0, 0.0, 0.0 };
+	double s[3] = { 1.0, 1.0, 1.0 };
+
+	int n = sscanf( line, "instance %63s (%lf,%lf,%lf) (%lf,%lf,%lf) (%lf,%lf,%lf)", name,
+					&t[0], &t[1], &t[2], &r[0], &r[1], &r[2], &s[0], &s[1], &s[2] );
+	if( n != 4 && n != 7 && n != 10 ) return NULL;
+	Vec3 translation( t[0], t[1], t[2] );
+	Vec3 rotation( r[0], r[1], r[2] );
+	Vec3 scale( s[0], s[1], s[2] );
+
+	map<string, BVH*>::iterator group = groups.find( name );
+	if( group == groups.end() )
+	{
+		cerr << "Unknown group " << name << endl;
+		return NULL;
+	}
+	return new Instance( group->second, translation, rotation, scale );
+}
+
 // This is a very minimal scene description reader.  It assumes that
 // each line contains a complete entity: an object definition,
 // a camera parameter, a material parameter, etc.  (Blank lines, and
@@ -39,11 +73,17 @@ bool Reader::ReadSceneDescription( const char *file_name, Scene &scene, Camera &
 	static char buff[512];
 	Object *newobj;
 	Object *obj = NULL;
+	Object *scene_obj = NULL;	// Objects of the scene while a group is being read.
+	Material material;			// Material of "obj", put in the table once it is complete.
+	char group_name[64];
+	bool in_group = false;
 	int line_num = 0;
 
 	FILE *fp = fopen( file_name, "r" );
 	if( fp == NULL ) return false;
 
+	scene.materials = new MaterialTable();
+
 	// Begin looping over all the lines of the file.
 	// Keep processing lines until the end of file is reached, or
 	// we find a line that is unrecognizable.
@@ -59,21 +99,62 @@ bool Reader::ReadSceneDescription( const char *file_name, Scene &scene, Camera &
 		// create a new instance of the object and return it as the function
 		// value.
 
-        if( ( newobj = Sphere  ::ReadString( line )) != NULL ) { newobj->next = obj; obj = newobj; continue; }
-        if( ( newobj = Cube    ::ReadString( line )) != NULL ) { newobj->next = obj; obj = newobj; continue; }
-        if( ( newobj = Triangle::ReadString( line )) != NULL ) { newobj->next = obj; obj = newobj; continue; }
-        if( ( newobj = Polygon ::ReadString( line )) != NULL ) { newobj->next = obj; obj = newobj; continue; }
+		newobj = Sphere::ReadString( line );
+		if( newobj == NULL ) newobj = Cube::ReadString( line );
+		if( newobj == NULL ) newobj = Triangle::ReadString( line );
+		if( newobj == NULL ) newobj = Polygon::ReadString( line );
+		if( newobj == NULL ) newobj = TriangleMesh::ReadString( line );
+		if( newobj == NULL ) newobj = ReadInstance( line );
+		if( newobj != NULL )
+		{
+			// The material lines read so far were those of the previous object.
+			if( obj != NULL ) obj->material_id = scene.materials->Add( material );
+			material = Material();
+			newobj->next = obj;
+			obj = newobj;
+			continue;
+		}
+
+		// Groups: their objects go to a list of their own until "endgroup".
+
+		if( !in_group && sscanf( line, "group %63s", group_name ) == 1 )
+		{
+			if( obj != NULL ) obj->material_id = scene.materials->Add( material );
+			material = Material();
+			scene_obj = obj;
+			obj = NULL;
+			in_group = true;
+			continue;
+		}
+		if( in_group && strncmp( line, "endgroup", 8 ) == 0 )
+		{
+			if( obj == NULL )
+			{
+				cerr << "Error reading scene file, line " << line_num << ": empty group " << group_name << endl;
+				return false;
+			}
+			obj->material_id = scene.materials->Add( material );
+			BVH *bvh = new BVH( BVH_BINNED );
+			bvh->Build( obj );
+			groups[group_name] = bvh;
+			obj = scene_obj;
+			in_group = false;
+
+			// Material lines after the group go on with the last object before it.
+			if( obj != NULL ) material = (*scene.materials)[obj->material_id];
+			continue;
+		}
 
 		// Now look for all the other stuff...  materials, camera,
 		// lights, etc.
 
-		if( Get( line, "diffuse"     , obj->material.m_Diffuse		) ) continue;
-		if( Get( line, "specular"    , obj->material.m_Specular		) ) continue;
-		if( Get( line, "reflectivity", obj->material.m_Reflectivity	) ) continue;
-		if( Get( line, "refractive_index", obj->material.m_RefractiveIndex	) ) continue;
-		if( Get( line, "opacity"		 , obj->material.m_Opacity			) ) continue;
-		if( Get( line, "Phong_exp"   , obj->material.m_Phong_exp	) ) continue;
-        if( Get( line, "emission"    , obj->material.m_Emission     ) ) continue;
+		if( Get( line, "diffuse"     , material.m_Diffuse		) ) continue;
+		if( Get( line, "specular"    , material.m_Specular		) ) continue;
+		if( Get( line, "reflectivity", material.m_Reflectivity	) ) continue;
+		if( Get( line, "refractive_index", material.m_RefractiveIndex	) ) continue;
+		if( Get( line, "opacity"		 , material.m_Opacity			) ) continue;
+		if( Get( line, "Phong_exp"   , material.m_Phong_exp	) ) continue;
+        if( Get( line, "emission"    , material.m_Emission     ) ) continue;
 		if( Get( line, "eye"         , camera.eye			        ) ) continue;
 		if( Get( line, "lookat"      , camera.lookat			    ) ) continue;            
 		if( Get( line, "up"          , camera.up					) ) continue;            
@@ -87,12 +168,20 @@ bool Reader::ReadSceneDescription( const char *file_name, Scene &scene, Camera &
 		}
 		if( Get( line, "amblight"    , scene.ambient				) ) continue;            
 		if( Get( line, "bgcolor"     , scene.bgcolor			    ) ) continue;  
+		if( sscanf( line, "accelerator %31s", scene.accel_name ) == 1 ) continue;
 
 		cerr << "Error reading scene file, line " << line_num 
 			 << ": " << line << endl;
 		return false;
 	}
 
+	if( in_group )
+	{
+		cerr << "Error reading scene file: group " << group_name << " has no endgroup" << endl;
+		return false;
+	}
+
+	if( obj != NULL ) obj->material_id = scene.materials->Add( material );
 	scene.first = obj;
 	cout << "done reading file." << endl;
 	return true;
@@ -15,12 +15,18 @@
 #include "Cube.h"
 #include "Triangle.h"
 #include "Polygon.h"
+#include "TriangleMesh.h"
+#include "Instance.h"
+
+#include <map>
+#include <string>
 
 class Reader
 {
 	public:
 
 		char format[128];
+		map<string, BVH*> groups;	// Bottom-level hierarchies of the groups read so far, by name.
 
 		bool Get( const char *line , const char *name , Vec3 &coord );
 		bool Get( const char *line , const char *name , Color &color );
@@ -32,7 +38,20 @@ class Reader
 		// a camera parameter, a material parameter, etc.  (Blank lines, and
 		// lines that begin with "#" are also okay.)  It fills in the fields of
 		// the scene and camera as it parses the file.
+		//
+		// Objects listed between "group <name>" and "endgroup" lines are not
+		// added to the scene.  They are kept apart in a BVH of their own, and
+		// each "instance <name> (tx,ty,tz) [(rx,ry,rz) [(sx,sy,sz)]]" line
+		// adds one transformed copy of them.
+		//
+		// A "mesh <file>" line loads the triangles of a Wavefront OBJ file
+		// as a single TriangleMesh object.
+		//
+		// Material lines apply to the object read last.  The materials are
+		// gathered in scene.materials, each distinct one once, and every
+		// object keeps the index of its own.
 		bool ReadSceneDescription( const char *file_name, Scene &scene, Camera &camera );
+		Object *ReadInstance( const char *line );
 		
 };
 
@@ -0,0 +1,25 @@
+/***************************************************************************
+* Scalar.h                                                                 *
+*                                                                          *
+* Scalar is the precision the renderer keeps its geometry and colors in:   *
+* the coordinates of Vec3, the channels of Color, the sides of Box3, the   *
+* hit distance of HitGeom and the weight of a Sample.  It is double, and   *
+* float when RAYTRACER_FLOAT is defined, as the "Release Float"            *
+* configuration does.  Single precision halves the memory those types take *
+* and the traffic of every hot loop; the double build is kept to check its *
+* images against (see ComparePrecision.bat).                               *
+*                                                                          *
+* Intersection tests still work out their distances in double, from the    *
+* single precision corners, so only what is stored is rounded.             *
+*                                                                          *
+***************************************************************************/
+#ifndef SCALAR_H
+#define SCALAR_H
+
+#if defined( RAYTRACER_FLOAT )
+typedef float Scalar;
+#else
+typedef double Scalar;
+#endif
+
+#endif
\ No newline at end of file
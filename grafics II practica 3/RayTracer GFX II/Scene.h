@@ -3,6 +3,8 @@
 
 #include "PointLight.h"
 #include "Object.h"
+#include "Accelerator.h"
+#include "LightTree.h"
 
 class Scene 
 {
@@ -12,6 +14,10 @@ class Scene
 		Color bgcolor;        // Background color, if ray does not hit anything. 
 		PointLight light[10]; // Info about each light source.
 		Object *first;        // The first of a list of objects.
+		Accelerator *accel;   // Acceleration structure over the list of objects.
+		LightTree *lights;    // Hierarchy over the emitters, to pick the ones sampled.
+		MaterialTable *materials;	// The materials the objects refer to.
+		char accel_name[32];  // Name of the accelerator requested by the scene file.
 };
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@ Sphere::Sphere( const Vec3 &cent, float rad )
 {
     center = cent;
     radius = rad;
+    radius2 = rad * rad;
 }
 
 
@@ -24,7 +25,42 @@ Box3 Sphere::GetBounds() const // Returns a bounding box.
     return box;
 }
 
+double Sphere::Area() const
+{
+	return FourPi * radius * radius;
+}
+
 bool Sphere::Intersect( const Ray &ray, HitGeom &hitgeom ) const
+{
+    if( Hit( ray, hitgeom ) == NULL ) return false;
+    GetHitAttributes( ray, hitgeom );
+    return true;
+}
+
+const Object *Sphere::Hit( const Ray &ray, HitGeom &hitgeom ) const
+{
+    double s;
+    if( !HitSphere( ray, center, radius, hitgeom.distance, s ) ) return NULL;
+    hitgeom.distance = Scalar( s );
+    hitgeom.object   = this;
+    return this;
+}
+
+// Fill in all the geometric information so that the shader can shade
+// this point.
+void Sphere::GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const
+{
+    hitgeom.point  = ray.origin + hitgeom.distance * ray.direction;
+    hitgeom.normal = Unit( hitgeom.point - center );
+    hitgeom.origin = ray.origin;
+}
+
+bool Sphere::Occludes( const Ray &ray, double max_distance ) const
+{
+    return OccludesSphere( ray, center, radius, max_distance );
+}
+
+bool HitSphere( const Ray &ray, const Vec3 &center, float radius, double max_distance, double &t )
 {
     Vec3 A = ray.origin - center;
     Vec3 R = ray.direction;
@@ -45,7 +81,7 @@ bool Sphere::Intersect( const Ray &ray, HitGeom &hitgeom ) const
     if( s > 0.0 )
         {
         // If the closest intersection is too far away, report a miss.
-        if( s > hitgeom.distance ) return false;
+        if( s > max_distance ) return false;
         }
     else
         {
@@ -54,94 +90,70 @@ bool Sphere::Intersect( const Ray &ray, HitGeom &hitgeom ) const
         // positive, it means we are inside the sphere.
         s = ( -b + discr ) * 0.5;
         if( s <= 0 ) return false;
-        if( s > hitgeom.distance ) return false;
+        if( s > max_distance ) return false;
         }
 
-    // We have an actual hit.  Fill in all the geometric information so
-    // that the shader can shade this point.
-
-    hitgeom.distance = s;
-    hitgeom.point    = ray.origin + s * R;
-    hitgeom.normal   = Unit( hitgeom.point - center );
-    hitgeom.origin   = ray.origin;
+    // We have an actual hit.
+    t = s;
     return true;
 }
 
-Sample Sphere::GetSample( const Vec3 &P, const Vec3 &N ) const
+// Same roots as HitSphere.
+bool OccludesSphere( const Ray &ray, const Vec3 &center, float radius, double max_distance )
 {
-	Vec3 reflect;		// Vector of reflection between the sphere on 0,0,d and the current sphere
-	float s, t;			// Coordinates of the sample on the unit square
-	float r;
-	float d;			// Distance between P and the center of the current sphere
-	float alfa;			// Angle between 0,0,1 and every vector that goes from 0,0,0 to the sphere
-						// with center in 0,0,d.
-	float h;			// Distance from the origin to the base of the cap defined by the solid angle
-	Ray ray;			// Ray used to find the intersecion of the vector sample direction and the sphere
-	HitGeom hitgeom;	// Information about the intersection of the ray and the sphere
-	float weight;		// Weight applied to every sample
-
-	Sample sample;
-
-	// Find the unit vector that lies between the vector from the point P to the
-	// center of the sphere and the vector (0, 0, 1).
-
-	reflect = Unit( Unit( center - P ) + Vec3( 0, 0, 1 ) );
-
-	// Compute the distance from the point P to the base of the cap formed by the solid angle
-	// substained by the sphere on the point P.
-
-	// Compute distance d
-	d = (float) dist( P, center );
-	// Compute angle alfa
-	alfa = (float) asin( radius / d );
-	// Decrements alfa espsilon to avoid vectors pointing the tangent of the
-	// sphere that can be missed when looking for its position into the sphere
-	alfa -= alfa * (float) Epsilon;
-	// Compute h
-	h = (float) cos( alfa );
-
-	// Compute the weigth
-	// Weight is computed as the solid angle
-	weight = ( (float)TwoPi * ( 1 - h ) );
-
-	// Compute the sample
-
-	// Generates two random values for s and t coordinates
-	s = (float) rand( 0.0, 1.0 );
-	t = (float) rand( 0.0, 1.0 );
-
-    // Find the sample on the unit sphere centered in the origin
-	// In fact, we are computing a unit vector
-
-	// Compute factor r
-	r = h + ( s * ( 1 - h ) );
-	r *= r;
-	r = (float) sqrt( 1 - r );
-	// Compute the sample on the unit sphere
-	sample.P = Vec3( r * cos( TwoPi * t ), r * sin( TwoPi * t ), (1-h)*s + h);
+    Vec3 A = ray.origin - center;
+    double b = 2.0 * ( A * ray.direction );
+    double discr = b * b - 4.0 * ( A * A - radius * radius );
 
-	// Rotate the unit vector to be pointing to the current sphere. Computes it
-	// with a reflection on the middle vector found avobe
+    if( discr < 0.0 ) return false;
 
-	sample.P = - sample.P;
-	sample.P = Reflection( sample.P, reflect );
+    discr = sqrt( discr );
+    double s = ( -b - discr ) * 0.5;
+    if( s <= 0.0 ) s = ( -b + discr ) * 0.5;
+    return s > 0.0 && s <= max_distance;
+}
 
-	// Find the sample on the current sphere by computing ray-sphere intersection.
-	// The ray origin is the point P and it direction is the vector just computed
+Sample Sphere::GetSample( const Vec3 &P, const Vec3 &N ) const
+{
+	Sample sample;
+	Vec3 W = center - P;
+	double d2 = W * W;	// Squared distance from P to the center.
 
-	ray.direction = sample.P;
-	ray.origin = P;
-	hitgeom.distance = Infinity;
-	if( Intersect( ray, hitgeom ) == false )
+	// From inside, the sphere covers every direction and there is no cone.
+	if( d2 <= radius2 )
 	{
-		// It shouldn't occur
-		cout<<"Error, sample should hit the sphere"<<endl;
+		sample.P = center;
+		sample.w = 0;
 		return sample;
 	}
-	// Stores the sample coordinates
-	sample.P = hitgeom.point;
-	// Stores the sample weight
-	sample.w = weight;
 
-    return sample;
+	double d = sqrt( d2 );
+	W = W / d;
+
+	// The sphere fills the directions around W up to the angle whose sine is
+	// radius / d.  1 - cos_max is worked out from the squared sine, since
+	// the difference loses all its digits when the sphere looks small.
+	double sin2_max = radius2 / d2;
+	double one_minus_cos_max = sin2_max / ( 1.0 + sqrt( 1.0 - sin2_max ) );
+
+	// Uniform over the solid angle of the cone: the cosine of the angle to W
+	// is uniform between cos_max and 1, and the angle around W in [0, 2 Pi).
+	double one_minus_cos = rand( 0.0, 1.0 ) * one_minus_cos_max;
+	double phi = TwoPi * rand( 0.0, 1.0 );
+	double cos_theta = 1.0 - one_minus_cos;
+	double sin_theta = sqrt( one_minus_cos * ( 2.0 - one_minus_cos ) );
+
+	Vec3 U, V;
+	OrthonormalBasis( W, U, V );
+	Vec3 direction = cos_theta * W + ( sin_theta * cos( phi ) ) * U + ( sin_theta * sin( phi ) ) * V;
+
+	// The smaller root of the ray-sphere equation (see Sphere.h) along the direction
+	// from P.  Its discriminant can only fall below zero by rounding, at the
+	// edge of the cone.
+	double discr = radius2 - d2 * sin_theta * sin_theta;
+	double t = d * cos_theta - sqrt( discr > 0.0 ? discr : 0.0 );
+
+	sample.P = P + t * direction;
+	sample.w = Scalar( TwoPi * one_minus_cos_max );	// Solid angle of the cone.
+	return sample;
 }
\ No newline at end of file
@@ -21,12 +21,27 @@ class Sphere : public Object
 	public:
 		Vec3  center;
 		float radius;
+		float radius2;	// radius * radius, worked out once for GetSample.
 
 		Sphere( const Vec3 &center, float radius );
 		bool Intersect( const Ray &ray, HitGeom &hitgeom ) const;
+		bool Occludes( const Ray &ray, double max_distance ) const;
+		const Object *Hit( const Ray &ray, HitGeom &hitgeom ) const;
+		void GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const;
 		Box3 GetBounds() const;
+		// Picks a direction uniformly in the cone the sphere fills as seen
+		// from P, and returns the point where it meets the near side of the
+		// sphere, weighted by the solid angle of the cone.
 		Sample GetSample( const Vec3 &P, const Vec3 &N ) const;
+		double Area() const;
 		static Object *ReadString( const char *params );
 };
 
+// The ray-sphere tests used by Sphere, on the center and radius alone, so
+// that the primitive arrays of the accelerators can use them too (see
+// Primitives.h).  HitSphere returns true if the ray hits the sphere at a
+// distance between 0 and max_distance, which is left in "t".
+bool HitSphere( const Ray &ray, const Vec3 &center, float radius, double max_distance, double &t );
+bool OccludesSphere( const Ray &ray, const Vec3 &center, float radius, double max_distance );
+
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include <fstream>
+#include <string>
+
+#include "Stats.h"
+#include "Accelerator.h"
+
+QueryCounters query_counters = { 0, 0 };
+
+static const char *const RayKindNames[NUM_RAY_KINDS] = { "camera", "indirect", "shadow" };
+
+void TreeStats::AddLeaf( int size, int depth )
+{
+	if( size >= (int)leaf_sizes.size() ) leaf_sizes.resize( size + 1, 0 );
+	leaf_sizes[size]++;
+	if( depth > max_depth ) max_depth = depth;
+}
+
+RenderStats::RenderStats()
+{
+	for( int k = 0; k < NUM_RAY_KINDS; k++ ) rays[k] = nodes[k] = primitives[k] = 0;
+}
+
+void RenderStats::Add( RayKind kind, const QueryCounters &start )
+{
+	rays[kind]++;
+	nodes[kind]      += query_counters.nodes - start.nodes;
+	primitives[kind] += query_counters.primitives - start.primitives;
+}
+
+bool RenderStats::Write( const char *file_name, const Accelerator &accel, double seconds ) const
+{
+	ofstream out( file_name );
+	if( !out ) return false;
+
+	TreeStats tree;
+	accel.GetTreeStats( tree );
+
+	out << "{" << endl;
+	out << "\t\"accelerator\": \"" << accel.Name() << "\"," << endl;
+	out << "\t\"precision\": \"" << ( sizeof( Scalar ) == sizeof( float ) ? "float" : "double" ) << "\"," << endl;
+	out << "\t\"build_ms\": " << accel.build_time * 1000.0 << "," << endl;
+	out << "\t\"sah_cost\": " << accel.Cost() << "," << endl;
+	out << "\t\"max_depth\": " << tree.max_depth << "," << endl;
+	out << "\t\"leaf_sizes\": [";
+	for( size_t n = 0; n < tree.leaf_sizes.size(); n++ ) out << ( n > 0 ? ", " : "" ) << tree.leaf_sizes[n];
+	out << "]," << endl;
+	out << "\t\"render_seconds\": " << seconds << "," << endl;
+	out << "\t\"rays\": {" << endl;
+	for( int k = 0; k < NUM_RAY_KINDS; k++ )
+	{
+		double count = rays[k] > 0 ? (double)rays[k] : 1.0;
+		out << "\t\t\"" << RayKindNames[k] << "\": { \"count\": " << rays[k]
+			<< ", \"nodes_per_ray\": " << nodes[k] / count
+			<< ", \"primitives_per_ray\": " << primitives[k] / count << " }"
+			<< ( k + 1 < NUM_RAY_KINDS ? "," : "" ) << endl;
+	}
+	out << "\t}" << endl;
+	out << "}" << endl;
+	return !out.fail();
+}
+
+bool ReadRenderSeconds( const char *file_name, double &seconds )
+{
+	ifstream in( file_name );
+	string line;
+	while( getline( in, line ) )
+	{
+		size_t at = line.find( "\"render_seconds\":" );
+		if( at != string::npos ) return sscanf( line.c_str() + at, "\"render_seconds\": %lf", &seconds ) == 1;
+	}
+	return false;
+}
\ No newline at end of file
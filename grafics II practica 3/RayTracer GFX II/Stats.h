@@ -0,0 +1,85 @@
+#ifndef STATS_H
+#define STATS_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines the statistics gathered to judge the acceleration      *
+* structures.  While rays are traced, the accelerators count every node    *
+* they visit and every object they test in a global set of counters, and   *
+* the ray tracer charges the work of each query to the kind of ray that    *
+* made it: rays from the camera, indirect rays and shadow rays.  Once the  *
+* image is done, those counts are written, along with the shape of the     *
+* structure (its SAH cost, the sizes of its leaves and its depth), to a    *
+* JSON file next to the image, so that they can be compared between runs.  *
+*                                                                          *
+* A node is whatever the structure steps through: a node of a binary tree, *
+* a whole node of a wide one, or a cell of a grid.                         *
+*                                                                          *
+***************************************************************************/
+
+#include <vector>
+
+class Accelerator;
+
+enum RayKind // What a ray is cast for.
+{
+	CAMERA_RAY,		// From the eye through a pixel.
+	INDIRECT_RAY,	// Bounced off a surface to gather indirect light.
+	SHADOW_RAY,		// Towards a light, to tell if it is visible.
+	NUM_RAY_KINDS
+};
+
+class QueryCounters // Work done by the ray queries since the program started.
+{
+	public:
+		unsigned long long nodes;		// Nodes visited.
+		unsigned long long primitives;	// Objects tested.
+};
+
+extern QueryCounters query_counters;
+
+class QueryCount // Work of a single query, added to query_counters when it goes out of scope.
+{
+	public:
+		unsigned int nodes;
+		unsigned int primitives;
+
+		QueryCount() { nodes = primitives = 0; }
+		~QueryCount()
+		{
+			query_counters.nodes      += nodes;
+			query_counters.primitives += primitives;
+		}
+};
+
+class TreeStats // Shape of a built structure.
+{
+	public:
+		int              max_depth;		// Levels between the root and the deepest leaf.
+		std::vector<int> leaf_sizes;	// leaf_sizes[n] is the number of leaves with n objects.
+
+		TreeStats() { max_depth = 0; }
+		void AddLeaf( int size, int depth );
+};
+
+class RenderStats // Work done by the rays of a render, by kind of ray.
+{
+	public:
+		unsigned long long rays[NUM_RAY_KINDS];
+		unsigned long long nodes[NUM_RAY_KINDS];
+		unsigned long long primitives[NUM_RAY_KINDS];
+
+		RenderStats();
+
+		// Charges to a ray of the given kind the work counted since "start",
+		// a copy of query_counters taken before it was cast.
+		void Add( RayKind kind, const QueryCounters &start );
+
+		// Writes the counts and the shape of the accelerator as JSON.
+		bool Write( const char *file_name, const Accelerator &accel, double seconds ) const;
+};
+
+// Reads back the render time from a file written by RenderStats::Write.
+bool ReadRenderSeconds( const char *file_name, double &seconds );
+
+#endif
\ No newline at end of file
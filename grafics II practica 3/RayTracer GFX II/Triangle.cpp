@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "Triangle.h"
 
 //=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~//
@@ -7,8 +9,25 @@
 // simple flat triangle with no normal vector interpolation.  The         //
 // triangle structure is defined to accommodate the barycentric coord     //
 // method of intersecting a ray with a triangle.                          //
+//                                                                        //
+// That method intersects the plane first and only then checks whether    //
+// the point is inside, after rounding the distance to a float, so rays   //
+// can slip through the shared edge of two triangles.  The edges B - A    //
+// and C - A are precomputed as well, for the kernels that work on them   //
+// directly; Triangle::kernel chooses the one used.                       //
 //=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~=~//
 
+TriangleKernel Triangle::kernel = TRIANGLE_WATERTIGHT;
+
+bool Triangle::KernelByName( const char *name, TriangleKernel &k )
+{
+	if( strcmp( name, "barycentric" ) == 0 ) k = TRIANGLE_BARYCENTRIC;
+	else if( strcmp( name, "moller" ) == 0 ) k = TRIANGLE_MOLLER_TRUMBORE;
+	else if( strcmp( name, "watertight" ) == 0 ) k = TRIANGLE_WATERTIGHT;
+	else return false;
+	return true;
+}
+
 Triangle::Triangle( const Vec3 &A_, const Vec3 &B_, const Vec3 &C_ )
     {
 	float base;		// Length of the base of the triangle
@@ -19,6 +38,8 @@ Triangle::Triangle( const Vec3 &A_, const Vec3 &B_, const Vec3 &C_ )
 	A = A_;
 	B = B_;
 	C = C_;
+	E1 = B - A;
+	E2 = C - A;
 
 	// Compute the normal to plane of the triangle
 	// Cross product between two vectors created by points fo the triangle
@@ -33,9 +54,9 @@ Triangle::Triangle( const Vec3 &A_, const Vec3 &B_, const Vec3 &C_ )
 	// Computes the bounding box;
 
 	// Initiallizes the box coordinates
-    box.X.min = box.X.min  = A.x;
-    box.Y.min = box.Y.min  = A.y;
-    box.Z.min = box.Z.min  = A.z;
+    box.X.min = box.X.max  = A.x;
+    box.Y.min = box.Y.max  = A.y;
+    box.Z.min = box.Z.max  = A.z;
 	// Check B coordinates
 	if( B.x < box.X.min ) box.X.min = B.x;
 	else if( B.x > box.X.max ) box.X.max = B.x;
@@ -119,7 +140,211 @@ Box3 Triangle::GetBounds() const // Return pre-computed box.
     return box;
     }
 
+// The corners, which Split clips, and not only the bounds.
+unsigned long long Triangle::Hash( unsigned long long hash ) const
+{
+	hash = Object::Hash( hash );
+	hash = HashBytes( hash, &A, sizeof( A ) );
+	hash = HashBytes( hash, &B, sizeof( B ) );
+	return HashBytes( hash, &C, sizeof( C ) );
+}
+
+double Triangle::Area() const
+{
+	return area;
+}
+
+// A flat triangle has a single normal.
+void Triangle::GetNormalCone( Vec3 &axis_, double &spread ) const
+{
+	axis_ = N;
+	spread = 0.0;
+}
+
+// Grows the box to contain the point.
+static void Grow( Box3 &box, const Vec3 &P )
+{
+	if( P.x < box.X.min ) box.X.min = P.x;
+	if( P.x > box.X.max ) box.X.max = P.x;
+	if( P.y < box.Y.min ) box.Y.min = P.y;
+	if( P.y > box.Y.max ) box.Y.max = P.y;
+	if( P.z < box.Z.min ) box.Z.min = P.z;
+	if( P.z > box.Z.max ) box.Z.max = P.z;
+}
+
+// Bounds of the parts of the triangle on each side of the plane, within the
+// box.  The corners on each side and the points where the edges cross the
+// plane are collected, so the halves stay tight around thin triangles.
+void Triangle::Split( const Box3 &box, int axis, double position, Box3 &left, Box3 &right ) const
+{
+	const Vec3 *corner[3] = { &A, &B, &C };
+
+	left  = EmptyBox();
+	right = EmptyBox();
+	for( int i = 0; i < 3; i++ )
+	{
+		const Vec3 &P = *corner[i];
+		const Vec3 &Q = *corner[( i + 1 ) % 3];
+		double p = Component( P, axis );
+		double q = Component( Q, axis );
+
+		if( p <= position ) Grow( left, P );
+		if( p >= position ) Grow( right, P );
+		if( ( p < position && q > position ) || ( p > position && q < position ) )
+		{
+			Vec3 X = P + ( ( position - p ) / ( q - p ) ) * ( Q - P );
+			Grow( left, X );
+			Grow( right, X );
+		}
+	}
+
+	left  = Intersection( left, box );
+	right = Intersection( right, box );
+}
+
 bool Triangle::Intersect( const Ray &ray, HitGeom &hitgeom ) const
+{
+	if( Hit( ray, hitgeom ) == NULL ) return false;
+	GetHitAttributes( ray, hitgeom );
+	return true;
+}
+
+const Object *Triangle::Hit( const Ray &ray, HitGeom &hitgeom ) const
+{
+	double t;
+	bool hit;
+
+	if( kernel == TRIANGLE_BARYCENTRIC ) hit = HitBarycentric( ray, hitgeom.distance, t );
+	else if( kernel == TRIANGLE_MOLLER_TRUMBORE ) hit = HitMollerTrumbore( ray, A, E1, E2, hitgeom.distance, t );
+	else hit = HitWatertight( ray, A, B, C, hitgeom.distance, t );
+	if( !hit ) return NULL;
+
+	hitgeom.distance = Scalar( t );
+	hitgeom.object   = this;
+	return this;
+}
+
+void Triangle::GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const
+{
+	hitgeom.normal = N;
+	hitgeom.origin = ray.origin;
+	hitgeom.point  = ray.origin + hitgeom.distance * ray.direction;
+}
+
+bool Triangle::Occludes( const Ray &ray, double max_distance ) const
+{
+	double t;
+
+	if( kernel == TRIANGLE_BARYCENTRIC ) return OccludesBarycentric( ray, max_distance );
+	if( kernel == TRIANGLE_MOLLER_TRUMBORE ) return HitMollerTrumbore( ray, A, E1, E2, max_distance, t );
+	return HitWatertight( ray, A, B, C, max_distance, t );
+}
+
+// The same tests without a Triangle, for the primitive arrays of the
+// accelerators, which keep the corners and the edges.
+bool HitTriangle( const Ray &ray, const Vec3 &A, const Vec3 &B, const Vec3 &C, const Vec3 &E1, const Vec3 &E2, double max_distance, double &t )
+{
+	if( Triangle::kernel == TRIANGLE_MOLLER_TRUMBORE ) return HitMollerTrumbore( ray, A, E1, E2, max_distance, t );
+	return HitWatertight( ray, A, B, C, max_distance, t );
+}
+
+bool OccludesTriangle( const Ray &ray, const Vec3 &A, const Vec3 &B, const Vec3 &C, const Vec3 &E1, const Vec3 &E2, double max_distance )
+{
+	double t;
+
+	if( Triangle::kernel == TRIANGLE_MOLLER_TRUMBORE ) return HitMollerTrumbore( ray, A, E1, E2, max_distance, t );
+	return HitWatertight( ray, A, B, C, max_distance, t );
+}
+
+// Moller-Trumbore: writes the point as A + u E1 + v E2 and solves for the
+// distance, u and v together with Cramer's rule, which takes two cross
+// products and needs neither the plane nor M.
+bool HitMollerTrumbore( const Ray &ray, const Vec3 &A, const Vec3 &E1, const Vec3 &E2, double max_distance, double &t )
+{
+	Vec3 p = ray.direction ^ E2;
+	double det = E1 * p;
+	if( det == 0.0 ) return false;	// The ray is parallel to the triangle
+
+	double inv_det = 1.0 / det;
+	Vec3 s = ray.origin - A;
+	double u = ( s * p ) * inv_det;
+	if( u < 0.0 || u > 1.0 ) return false;
+
+	Vec3 q = s ^ E1;
+	double v = ( ray.direction * q ) * inv_det;
+	if( v < 0.0 || u + v > 1.0 ) return false;
+
+	t = ( E2 * q ) * inv_det;
+	return t > 0.0 && t < max_distance;
+}
+
+// Watertight test of Woop, Benthin and Wald.  The corners are moved into a
+// space where the ray starts at the origin and runs along +Z, so the test
+// becomes two dimensional: the ray hits the triangle if the origin lies on
+// the same side of its three edges.  Two triangles that share an edge
+// compute the same edge function for it, with opposite signs, so a ray
+// through the edge hits one of them, or both, but never neither.
+bool HitWatertight( const Ray &ray, const Vec3 &A, const Vec3 &B, const Vec3 &C, double max_distance, double &t )
+{
+	return HitWatertight( WatertightRay( ray ), A, B, C, max_distance, t );
+}
+
+WatertightRay::WatertightRay( const Ray &ray )
+{
+	// Z is the dominant axis of the direction; X and Y are swapped to keep
+	// the winding of the triangle when it points backwards.
+	double dx = fabs( ray.direction.x ), dy = fabs( ray.direction.y ), dz = fabs( ray.direction.z );
+	kz = dx > dy ? ( dx > dz ? 0 : 2 ) : ( dy > dz ? 1 : 2 );
+	kx = ( kz + 1 ) % 3;
+	ky = ( kx + 1 ) % 3;
+	if( Component( ray.direction, kz ) < 0.0 ) { int k = kx; kx = ky; ky = k; }
+
+	Sz = 1.0 / Component( ray.direction, kz );
+	Sx = Component( ray.direction, kx ) * Sz;
+	Sy = Component( ray.direction, ky ) * Sz;
+	Ox = Component( ray.origin, kx );
+	Oy = Component( ray.origin, ky );
+	Oz = Component( ray.origin, kz );
+}
+
+// The operations, and their order, are the ones the packet kernel of
+// TriangleMesh repeats with vector instructions, which gives the same
+// results bit for bit; keep them in step.
+bool HitWatertight( const WatertightRay &ray, const Vec3 &A, const Vec3 &B, const Vec3 &C, double max_distance, double &t )
+{
+	int kx = ray.kx, ky = ray.ky, kz = ray.kz;
+	double Sx = ray.Sx, Sy = ray.Sy, Sz = ray.Sz;
+
+	// Corners relative to the origin, subtracted in double as the packet
+	// kernel does, also when Scalar is float.
+	double az = Component( A, kz ) - ray.Oz;
+	double bz = Component( B, kz ) - ray.Oz;
+	double cz = Component( C, kz ) - ray.Oz;
+	double ax = ( Component( A, kx ) - ray.Ox ) - Sx * az;
+	double ay = ( Component( A, ky ) - ray.Oy ) - Sy * az;
+	double bx = ( Component( B, kx ) - ray.Ox ) - Sx * bz;
+	double by = ( Component( B, ky ) - ray.Oy ) - Sy * bz;
+	double cx = ( Component( C, kx ) - ray.Ox ) - Sx * cz;
+	double cy = ( Component( C, ky ) - ray.Oy ) - Sy * cz;
+
+	// Scaled barycentric coordinates: twice the signed areas of the
+	// triangles between the origin and each edge.
+	double U = cx * by - cy * bx;
+	double V = ax * cy - ay * cx;
+	double W = bx * ay - by * ax;
+	if( ( U < 0.0 || V < 0.0 || W < 0.0 ) && ( U > 0.0 || V > 0.0 || W > 0.0 ) ) return false;
+
+	double det = U + V + W;
+	if( det == 0.0 ) return false;	// The ray lies in the plane of the triangle
+
+	double T = ( U * az + V * bz + W * cz ) * Sz;
+	t = T / det;
+	return t > 0.0 && t < max_distance;
+}
+
+// The original test: intersects the supporting plane, projects the point
+// and applies the inverse barycentric transform.
+bool Triangle::HitBarycentric( const Ray &ray, double max_distance, double &t ) const
     {
 	Plane Pl;	// Plane supporting the triangle
 	float dist;	// Distance from the origin of the ray to the plane Pl
@@ -133,7 +358,7 @@ bool Triangle::Intersect( const Ray &ray, HitGeom &hitgeom ) const
 	//  with the supporting plane of the triangle
 	dist = (float) Pl.Intersect( ray );
 
-	if( ( dist > 0.0f ) && ( dist < hitgeom.distance ) )
+	if( ( dist > 0.0f ) && ( dist < max_distance ) )
 		{
 		// The object is behind the ray
 
@@ -153,11 +378,8 @@ bool Triangle::Intersect( const Ray &ray, HitGeom &hitgeom ) const
 		// be between 0 and 1.
 		if( Bar.x >= 0 && Bar.x <= 1 && Bar.y >= 0 && Bar.y <= 1 && Bar.z >= 0 && Bar.z <= 1 )
 			{
-			// There is an intersection, fill all hitgeom fields
-			hitgeom.distance = dist;
-			hitgeom.normal	 = N;
-			hitgeom.origin	 = ray.origin;
-			hitgeom.point	 = P;
+			// There is an intersection
+			t = dist;
 			return true;
 			}
 		}
@@ -167,6 +389,24 @@ bool Triangle::Intersect( const Ray &ray, HitGeom &hitgeom ) const
 }
 
 
+// Same test as HitBarycentric, without building the plane.
+bool Triangle::OccludesBarycentric( const Ray &ray, double max_distance ) const
+	{
+	double div = N * ray.direction;
+	if( div == 0.0 ) return false;
+
+	float dist = (float)( -( N * ray.origin + d ) / div );
+	if( dist <= 0.0f || dist >= max_distance ) return false;
+
+	Vec3 P = ray.origin + ( dist * ( ray.direction ) );
+	if( axis == 0 )		 P.x = 1.0f;
+	else if( axis == 1 ) P.y = 1.0f;
+	else if( axis == 2 ) P.z = 1.0f;
+
+	Vec3 Bar = M * P;
+	return Bar.x >= 0 && Bar.x <= 1 && Bar.y >= 0 && Bar.y <= 1 && Bar.z >= 0 && Bar.z <= 1;
+	}
+
 Sample Triangle::GetSample( const Vec3 &P, const Vec3 &N_point ) const
 {
 	float x, y;			// Origin of the little squares used for the stratisfied sampling
@@ -200,7 +440,7 @@ Sample Triangle::GetSample( const Vec3 &P, const Vec3 &N_point ) const
 	sample.w = area * cos_theta / rsqr;
 	// Limit weight to twopi
 	if (sample.w > TwoPi)
-		sample.w = TwoPi;
+		sample.w = Scalar( TwoPi );
 
 	return sample;
 }
\ No newline at end of file
@@ -4,23 +4,79 @@
 #include "Object.h"
 #include "Mat3x3.h"
 #include "Plane.h"
+
+enum TriangleKernel // How a ray is intersected with a triangle.
+{
+	TRIANGLE_BARYCENTRIC,		// Hits the plane, then maps the point to barycentric coordinates with M.
+	TRIANGLE_MOLLER_TRUMBORE,	// Solves for the distance and the coordinates at once from the edges.
+	TRIANGLE_WATERTIGHT			// Shears the triangle into the space of the ray and tests the sides of
+								// its edges there (Woop et al.), so no ray slips between two triangles.
+};
+
 class Triangle : public Object
 {
 	public:
+		static TriangleKernel kernel;	// Used by every triangle.
+
 		Mat3x3 M;     // Inverse of barycentric coord transform.
 		Vec3   N;     // Normal to plane of triangle;
 		double d;     // Distance from origin to plane of triangle.
 		Box3   box;   // Bounding box;
 		int    axis;  // The dominant axis;
 		Vec3 A, B, C; // Corners of the triangle
+		Vec3 E1, E2;  // Edges B - A and C - A
 		Vec3   center;
 		float area;   // Area of the triangle
 
 		Triangle( const Vec3 &A, const Vec3 &B, const Vec3 &C );
 		bool Intersect( const Ray &ray, HitGeom &hitgeom ) const;
+		bool Occludes( const Ray &ray, double max_distance ) const;
+		const Object *Hit( const Ray &ray, HitGeom &hitgeom ) const;
+		void GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const;
 		Box3 GetBounds() const;
+		unsigned long long Hash( unsigned long long hash ) const;
+		void Split( const Box3 &box, int axis, double position, Box3 &left, Box3 &right ) const;
 		static Object *ReadString( const char *params );
 		Sample GetSample( const Vec3 &P, const Vec3 &N_point ) const;
+		double Area() const;
+		void GetNormalCone( Vec3 &axis, double &spread ) const;
+
+		// Returns the kernel with the given name ("barycentric", "moller"
+		// or "watertight") in "k", or false if the name is unknown.
+		static bool KernelByName( const char *name, TriangleKernel &k );
+
+	private:
+		bool HitBarycentric( const Ray &ray, double max_distance, double &t ) const;
+		bool OccludesBarycentric( const Ray &ray, double max_distance ) const;
 };
 
+// The ray-triangle tests used by the kernels, on the corners of a triangle
+// or its first corner and edges, so that TriangleMesh can use them too.
+// They return true if the ray hits the triangle at a distance between 0
+// and max_distance, which is left in "t".
+bool HitMollerTrumbore( const Ray &ray, const Vec3 &A, const Vec3 &E1, const Vec3 &E2, double max_distance, double &t );
+bool HitWatertight( const Ray &ray, const Vec3 &A, const Vec3 &B, const Vec3 &C, double max_distance, double &t );
+
+class WatertightRay // The part of the watertight test that depends only on the ray.
+{
+	public:
+		int    kx, ky, kz;	// Axes of the space of the ray; kz is the dominant axis of its direction.
+		double Ox, Oy, Oz;	// Origin along kx, ky and kz, in double whatever Scalar is.
+		double Sx, Sy, Sz;	// Shear and scale that take the direction to +Z.
+
+		WatertightRay( const Ray &ray );
+};
+
+// The watertight test with the ray already set up, for callers that test
+// one ray against many triangles.
+bool HitWatertight( const WatertightRay &ray, const Vec3 &A, const Vec3 &B, const Vec3 &C, double max_distance, double &t );
+
+// The tests of Triangle on its corners alone, for the primitive arrays of
+// the accelerators (see Primitives.h).  They use Triangle::kernel, which
+// must not be TRIANGLE_BARYCENTRIC since that one needs M.  E1 and E2 are
+// the edges B - A and C - A, precomputed for Moller-Trumbore; the watertight
+// test takes the corners themselves, so shared edges stay consistent.
+bool HitTriangle( const Ray &ray, const Vec3 &A, const Vec3 &B, const Vec3 &C, const Vec3 &E1, const Vec3 &E2, double max_distance, double &t );
+bool OccludesTriangle( const Ray &ray, const Vec3 &A, const Vec3 &B, const Vec3 &C, const Vec3 &E1, const Vec3 &E2, double max_distance );
+
 #endif 
\ No newline at end of file
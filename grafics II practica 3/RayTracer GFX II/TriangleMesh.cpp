@@ -0,0 +1,475 @@
+#include <algorithm>
+#include <immintrin.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+#include "TriangleMesh.h"
+#include "Triangle.h"
+#include "WideBVH.h"
+#include "Cpu.h"
+
+static const int    MaxLeafSize   = 8;		// Nodes with this many faces or fewer are always leaves, one packet each
+static const int    MaxDepth      = 60;		// Deeper nodes are only halved, until they fit in a packet
+static const int    StackSize     = 96;		// MaxDepth, plus the halvings of 2^31 faces
+
+TriangleMesh::TriangleMesh( std::vector<Vec3> &vertices_, std::vector<MeshFace> &faces_ )
+{
+	std::vector<BVHPrim> prims( faces_.size() );
+
+	vertices.swap( vertices_ );
+	vertices.shrink_to_fit();
+	for( size_t i = 0; i < faces_.size(); i++ )
+	{
+		const MeshFace &face = faces_[i];
+		BVHPrim &prim = prims[i];
+		prim.box = EmptyBox();
+		for( int k = 0; k < 3; k++ )
+		{
+			const Vec3 &P = vertices[face.v[k]];
+			Box3 point;
+			point.X.min = point.X.max = P.x;
+			point.Y.min = point.Y.max = P.y;
+			point.Z.min = point.Z.max = P.z;
+			prim.box = Union( prim.box, point );
+		}
+		prim.center = Center( prim.box );
+		prim.object = NULL;
+		prim.index  = (int)i;
+	}
+
+	box = EmptyBox();
+	for( size_t i = 0; i < prims.size(); i++ ) box = Union( box, prims[i].box );
+	if( !prims.empty() ) BuildNode( prims, 0, (int)prims.size(), 0 );
+	nodes.shrink_to_fit();
+
+	// The leaves index the faces in the order the builder left them.
+	faces.resize( faces_.size() );
+	for( size_t i = 0; i < prims.size(); i++ ) faces[i] = faces_[prims[i].index];
+	std::vector<MeshFace>().swap( faces_ );
+
+	for( size_t p = 0; p < packets.size(); p++ )
+	{
+		TrianglePacket &packet = packets[p];
+		for( int i = 0; i < 8; i++ )
+		{
+			const MeshFace &face = faces[packet.first + ( i < packet.count ? i : packet.count - 1 )];
+			for( int k = 0; k < 3; k++ )
+			{
+				const Vec3 &P = vertices[face.v[k]];
+				packet.v[k][0][i] = (float)P.x;
+				packet.v[k][1][i] = (float)P.y;
+				packet.v[k][2][i] = (float)P.z;
+			}
+		}
+	}
+	packets.shrink_to_fit();
+
+	double total = 0.0;
+	cumulative_area.resize( faces.size() );
+	for( size_t i = 0; i < faces.size(); i++ )
+	{
+		const Vec3 &A = vertices[faces[i].v[0]];
+		total += 0.5 * Length( ( vertices[faces[i].v[1]] - A ) ^ ( vertices[faces[i].v[2]] - A ) );
+		cumulative_area[i] = (float)total;
+	}
+
+	next = NULL;
+}
+
+// Binned SAH builder over the faces, like the one of the scene BVH but on
+// a single thread, since meshes are built while the scene is read.  The
+// nodes are added depth-first at the end of "nodes"; returns the index of
+// the root of the subtree for prims[begin, end).
+int TriangleMesh::BuildNode( std::vector<BVHPrim> &prims, int begin, int end, int depth )
+{
+	int index = (int)nodes.size();
+	int count = end - begin;
+	Box3 bounds = EmptyBox();
+
+	nodes.push_back( MeshNode() );
+	for( int i = begin; i < end; i++ ) bounds = Union( bounds, prims[i].box );
+	for( int a = 0; a < 3; a++ )
+	{
+		nodes[index].lo[a] = RoundDown( Along( bounds, a ).min );
+		nodes[index].hi[a] = RoundUp( Along( bounds, a ).max );
+	}
+
+	ObjectSplit best;
+	best.axis = -1;
+	if( count > MaxLeafSize && depth < MaxDepth ) best = FindObjectSplit( prims, begin, end, bounds );
+
+	int split;
+	if( best.axis < 0 )
+	{
+		if( count <= MaxLeafSize )
+		{
+			// The corners are filled in once the faces are in leaf order.
+			TrianglePacket packet;
+			packet.first = begin;
+			packet.count = count;
+			nodes[index].offset = (int)packets.size();
+			nodes[index].count  = (short)count;
+			nodes[index].axis   = 0;
+			packets.push_back( packet );
+			return index;
+		}
+		// Too many faces with coincident centers: split them in halves.
+		split = begin + count / 2;
+		best.axis = 0;
+	}
+	else
+	{
+		BVHPrim *middle = std::partition( &prims[0] + begin, &prims[0] + end, [&]( const BVHPrim &p )
+		{
+			return best.Bin( p ) < best.bin;
+		} );
+		split = (int)( middle - &prims[0] );
+	}
+
+	BuildNode( prims, begin, split, depth + 1 );
+	int second = BuildNode( prims, split, end, depth + 1 );
+	nodes[index].offset = second;
+	nodes[index].count  = 0;
+	nodes[index].axis   = (short)best.axis;
+	return index;
+}
+
+// The packet test one triangle at a time, for processors without AVX.
+static int HitTrianglePacketScalar( const TrianglePacket &packet, const WatertightRay &ray, double max_distance, double t[8] )
+{
+	int mask = 0;
+
+	for( int i = 0; i < packet.count; i++ )
+	{
+		Vec3 A( packet.v[0][0][i], packet.v[0][1][i], packet.v[0][2][i] );
+		Vec3 B( packet.v[1][0][i], packet.v[1][1][i], packet.v[1][2][i] );
+		Vec3 C( packet.v[2][0][i], packet.v[2][1][i], packet.v[2][2][i] );
+		if( HitWatertight( ray, A, B, C, max_distance, t[i] ) ) mask |= 1 << i;
+	}
+	return mask;
+}
+
+// Corner "k" of four triangles of the packet, from "lane" on, moved into the
+// space of the ray: its coordinates along kx and ky after the shear, and its
+// distance along kz, as HitWatertight computes them.
+static TARGET_AVX inline void ShearCorner( const TrianglePacket &packet, const WatertightRay &ray, int k, int lane,
+										   __m256d &x, __m256d &y, __m256d &z )
+{
+	__m256d px = _mm256_sub_pd( _mm256_cvtps_pd( _mm_loadu_ps( &packet.v[k][ray.kx][lane] ) ), _mm256_set1_pd( ray.Ox ) );
+	__m256d py = _mm256_sub_pd( _mm256_cvtps_pd( _mm_loadu_ps( &packet.v[k][ray.ky][lane] ) ), _mm256_set1_pd( ray.Oy ) );
+	z = _mm256_sub_pd( _mm256_cvtps_pd( _mm_loadu_ps( &packet.v[k][ray.kz][lane] ) ), _mm256_set1_pd( ray.Oz ) );
+	x = _mm256_sub_pd( px, _mm256_mul_pd( _mm256_set1_pd( ray.Sx ), z ) );
+	y = _mm256_sub_pd( py, _mm256_mul_pd( _mm256_set1_pd( ray.Sy ), z ) );
+}
+
+// HitWatertight on four triangles at a time, in double precision.  No
+// fused multiply-adds, which would round differently from the scalar test.
+static TARGET_AVX int HitTrianglePacketAVX( const TrianglePacket &packet, const WatertightRay &ray, double max_distance, double t[8] )
+{
+	int mask = 0;
+	__m256d zero = _mm256_setzero_pd();
+
+	for( int lane = 0; lane < packet.count; lane += 4 )
+	{
+		__m256d ax, ay, az, bx, by, bz, cx, cy, cz;
+		ShearCorner( packet, ray, 0, lane, ax, ay, az );
+		ShearCorner( packet, ray, 1, lane, bx, by, bz );
+		ShearCorner( packet, ray, 2, lane, cx, cy, cz );
+
+		__m256d U = _mm256_sub_pd( _mm256_mul_pd( cx, by ), _mm256_mul_pd( cy, bx ) );
+		__m256d V = _mm256_sub_pd( _mm256_mul_pd( ax, cy ), _mm256_mul_pd( ay, cx ) );
+		__m256d W = _mm256_sub_pd( _mm256_mul_pd( bx, ay ), _mm256_mul_pd( by, ax ) );
+
+		__m256d negative = _mm256_or_pd( _mm256_or_pd( _mm256_cmp_pd( U, zero, _CMP_LT_OQ ), _mm256_cmp_pd( V, zero, _CMP_LT_OQ ) ), _mm256_cmp_pd( W, zero, _CMP_LT_OQ ) );
+		__m256d positive = _mm256_or_pd( _mm256_or_pd( _mm256_cmp_pd( U, zero, _CMP_GT_OQ ), _mm256_cmp_pd( V, zero, _CMP_GT_OQ ) ), _mm256_cmp_pd( W, zero, _CMP_GT_OQ ) );
+
+		__m256d det = _mm256_add_pd( _mm256_add_pd( U, V ), W );
+		__m256d T = _mm256_mul_pd( _mm256_add_pd( _mm256_add_pd( _mm256_mul_pd( U, az ), _mm256_mul_pd( V, bz ) ), _mm256_mul_pd( W, cz ) ), _mm256_set1_pd( ray.Sz ) );
+		__m256d dist = _mm256_div_pd( T, det );
+
+		__m256d hit = _mm256_andnot_pd( _mm256_and_pd( negative, positive ), _mm256_cmp_pd( det, zero, _CMP_NEQ_OQ ) );
+		hit = _mm256_and_pd( hit, _mm256_and_pd( _mm256_cmp_pd( dist, zero, _CMP_GT_OQ ), _mm256_cmp_pd( dist, _mm256_set1_pd( max_distance ), _CMP_LT_OQ ) ) );
+		_mm256_storeu_pd( t + lane, dist );
+		mask |= _mm256_movemask_pd( hit ) << lane;
+	}
+	return mask & ( ( 1 << packet.count ) - 1 );
+}
+
+int HitTrianglePacket( const TrianglePacket &packet, const WatertightRay &ray, double max_distance, double t[8] )
+{
+	if( CpuHasAVX() ) return HitTrianglePacketAVX( packet, ray, max_distance, t );
+	return HitTrianglePacketScalar( packet, ray, max_distance, t );
+}
+
+// Slab test against the single precision box of a node.
+static inline bool HitNode( const MeshNode &node, const Vec3 &origin, const Vec3 &inv_dir, double max_distance )
+{
+	Box3 box;
+	box.X.min = node.lo[0];  box.X.max = node.hi[0];
+	box.Y.min = node.lo[1];  box.Y.max = node.hi[1];
+	box.Z.min = node.lo[2];  box.Z.max = node.hi[2];
+	return HitBox( box, origin, inv_dir, max_distance );
+}
+
+// Returns the closest face hit nearer than "distance", which is updated,
+// or -1 if there is none.
+int TriangleMesh::Closest( const Ray &ray, double &distance ) const
+{
+	QueryCount work;
+	int closest = -1;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( nodes.empty() ) return -1;
+
+	WatertightRay wray( ray );
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+	bool negative[3] = { inv_dir.x < 0.0, inv_dir.y < 0.0, inv_dir.z < 0.0 };
+
+	for(;;)
+	{
+		const MeshNode &node = nodes[current];
+		work.nodes++;
+
+		if( HitNode( node, ray.origin, inv_dir, distance ) )
+		{
+			if( node.count > 0 )
+			{
+				// The nearest of the triangles hit; the first one on ties, as
+				// testing them one after the other would give.
+				const TrianglePacket &packet = packets[node.offset];
+				double t[8];
+				int mask = HitTrianglePacket( packet, wray, distance, t );
+				int nearest = -1;
+				work.primitives += node.count;
+				for( int i = 0; mask != 0; i++, mask >>= 1 )
+				{
+					if( ( mask & 1 ) && ( nearest < 0 || t[i] < t[nearest] ) ) nearest = i;
+				}
+				if( nearest >= 0 )
+				{
+					distance = t[nearest];
+					closest = packet.first + nearest;
+				}
+			}
+			else
+			{
+				if( negative[node.axis] )
+				{
+					stack[sp++] = current + 1;
+					current = node.offset;
+				}
+				else
+				{
+					stack[sp++] = node.offset;
+					current = current + 1;
+				}
+				continue;
+			}
+		}
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return closest;
+}
+
+bool TriangleMesh::Intersect( const Ray &ray, HitGeom &hitgeom ) const
+{
+	if( Hit( ray, hitgeom ) == NULL ) return false;
+	GetHitAttributes( ray, hitgeom );
+	return true;
+}
+
+// Only the face is recorded; its normal is worked out if the mesh is still
+// the closest object hit when the scene traversal is over.
+const Object *TriangleMesh::Hit( const Ray &ray, HitGeom &hitgeom ) const
+{
+	double distance = hitgeom.distance;
+	int face = Closest( ray, distance );
+	if( face < 0 ) return NULL;
+
+	hitgeom.distance = Scalar( distance );
+	hitgeom.part     = face;
+	hitgeom.object   = this;
+	return this;
+}
+
+void TriangleMesh::GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const
+{
+	const MeshFace &face = faces[hitgeom.part];
+	const Vec3 &A = vertices[face.v[0]];
+	const Vec3 &B = vertices[face.v[1]];
+	const Vec3 &C = vertices[face.v[2]];
+	hitgeom.normal = Unit( ( C - B ) ^ ( A - B ) );
+	hitgeom.origin = ray.origin;
+	hitgeom.point  = ray.origin + hitgeom.distance * ray.direction;
+}
+
+bool TriangleMesh::Occludes( const Ray &ray, double max_distance ) const
+{
+	QueryCount work;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( nodes.empty() ) return false;
+
+	WatertightRay wray( ray );
+	Vec3 inv_dir( SafeInverse( ray.direction.x ), SafeInverse( ray.direction.y ), SafeInverse( ray.direction.z ) );
+
+	for(;;)
+	{
+		const MeshNode &node = nodes[current];
+		work.nodes++;
+
+		if( HitNode( node, ray.origin, inv_dir, max_distance ) )
+		{
+			if( node.count > 0 )
+			{
+				double t[8];
+				work.primitives += node.count;
+				if( HitTrianglePacket( packets[node.offset], wray, max_distance, t ) != 0 ) return true;
+			}
+			else
+			{
+				stack[sp++] = node.offset;
+				current = current + 1;
+				continue;
+			}
+		}
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return false;
+}
+
+Box3 TriangleMesh::GetBounds() const
+{
+	return box;
+}
+
+unsigned long long TriangleMesh::Hash( unsigned long long hash ) const
+{
+	hash = Object::Hash( hash );
+	if( !vertices.empty() ) hash = HashBytes( hash, &vertices[0], vertices.size() * sizeof( Vec3 ) );
+	if( !faces.empty() ) hash = HashBytes( hash, &faces[0], faces.size() * sizeof( MeshFace ) );
+	return hash;
+}
+
+double TriangleMesh::Area() const
+{
+	return cumulative_area.empty() ? 0.0 : cumulative_area.back();
+}
+
+// Picks a face with a probability proportional to its area, and a point on
+// it the same way Triangle::GetSample does.  The weight is that of the
+// whole mesh seen from P through the point.
+Sample TriangleMesh::GetSample( const Vec3 &P, const Vec3 &N ) const
+{
+	Sample sample;
+
+	sample.P = P;
+	sample.w = 0.0;
+	if( faces.empty() ) return sample;
+
+	float r = (float)rand( 0.0, Area() );
+	int face = (int)( std::upper_bound( cumulative_area.begin(), cumulative_area.end(), r ) - cumulative_area.begin() );
+	if( face >= (int)faces.size() ) face = (int)faces.size() - 1;
+
+	const Vec3 &A = vertices[faces[face].v[0]];
+	const Vec3 &B = vertices[faces[face].v[1]];
+	const Vec3 &C = vertices[faces[face].v[2]];
+	double s = sqrt( rand( 0.0, 1.0 ) );
+	double t = rand( 0.0, 1.0 );
+	sample.P = ( 1 - s ) * A + ( s * ( 1 - t ) ) * B + ( s * t ) * C;
+
+	double rsqr = LengthSquared( sample.P - P );
+	if( rsqr <= 0.0 ) return sample;
+
+	double cos_theta = fabs( Unit( ( C - B ) ^ ( A - B ) ) * Unit( P - sample.P ) );
+	sample.w = Scalar( Area() * cos_theta / rsqr );
+	if( sample.w > TwoPi ) sample.w = Scalar( TwoPi );
+	return sample;
+}
+
+size_t TriangleMesh::MemoryUsed() const
+{
+	return vertices.size() * sizeof( Vec3 ) + faces.size() * sizeof( MeshFace ) + nodes.size() * sizeof( MeshNode ) +
+		   packets.size() * sizeof( TrianglePacket ) + cumulative_area.size() * sizeof( float );
+}
+
+// Index of a corner in an OBJ face, which counts from 1, or backwards from
+// the last vertex read if it is negative.  Texture and normal indices,
+// after a '/', are ignored.  Returns -1 if it is out of range.
+static int ObjIndex( const char *token, int num_vertices )
+{
+	int i = atoi( token );
+	if( i < 0 ) i += num_vertices;
+	else i -= 1;
+	return i >= 0 && i < num_vertices ? i : -1;
+}
+
+Object *TriangleMesh::ReadString( const char *params )
+{
+	char file_name[256];
+	char line[1024];
+	std::vector<Vec3>     points;
+	std::vector<MeshFace> triangles;
+
+	if( sscanf( params, "mesh %255s", file_name ) != 1 ) return NULL;
+
+	FILE *fp = fopen( file_name, "r" );
+	if( fp == NULL )
+	{
+		cerr << "Cannot open mesh " << file_name << endl;
+		return NULL;
+	}
+
+	while( fgets( line, sizeof( line ), fp ) != NULL )
+	{
+		if( line[0] == 'v' && ( line[1] == ' ' || line[1] == '\t' ) )
+		{
+			double x, y, z;
+			if( sscanf( line + 2, "%lf %lf %lf", &x, &y, &z ) == 3 ) points.push_back( Vec3( x, y, z ) );
+		}
+		else if( line[0] == 'f' && ( line[1] == ' ' || line[1] == '\t' ) )
+		{
+			// A fan of triangles around the first corner.
+			int corners[3];
+			int n = 0;
+			for( char *token = strtok( line + 2, " \t\r\n" ); token != NULL; token = strtok( NULL, " \t\r\n" ) )
+			{
+				int v = ObjIndex( token, (int)points.size() );
+				if( v < 0 ) break;
+				if( n < 3 ) corners[n++] = v;
+				else
+				{
+					corners[1] = corners[2];
+					corners[2] = v;
+				}
+				if( n == 3 )
+				{
+					MeshFace face;
+					face.v[0] = corners[0];
+					face.v[1] = corners[1];
+					face.v[2] = corners[2];
+					triangles.push_back( face );
+				}
+			}
+		}
+	}
+	fclose( fp );
+
+	if( triangles.empty() )
+	{
+		cerr << "Mesh " << file_name << " has no faces" << endl;
+		return NULL;
+	}
+
+	TriangleMesh *mesh = new TriangleMesh( points, triangles );
+	cout << "Mesh " << file_name << ": " << mesh->vertices.size() << " vertices, " << mesh->faces.size() << " triangles, "
+		 << mesh->MemoryUsed() / ( 1024.0 * 1024.0 ) << " MB." << endl;
+	return mesh;
+}
\ No newline at end of file
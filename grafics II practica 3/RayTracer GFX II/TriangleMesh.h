@@ -0,0 +1,95 @@
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+// A triangle mesh keeps its corners once, in a shared vertex buffer, and
+// every triangle as the indices of its three corners, which takes twelve
+// bytes instead of the few hundred of a Triangle object.  The scene sees
+// the whole mesh as a single object with a single material; inside, the
+// triangles have a BVH of their own, built when the mesh is loaded, whose
+// leaves hold ranges of the triangle array.  Its nodes keep their boxes in
+// single precision, rounded outwards.  Normals, edges and bounds are
+// worked out from the corners when they are needed: a hit only records the
+// index of the face, and GetHitAttributes finds its normal.
+//
+// Every leaf takes up to eight triangles, whose corners are also copied,
+// in single precision, into a packet laid out by corner, axis and
+// triangle.  A ray is tested against all the triangles of a packet at once
+// with the watertight test, four at a time with AVX, or one at a time on
+// processors without it; both do the same double precision operations in
+// the same order, so they find the same hits at the same distances.
+//
+// Meshes are read from Wavefront OBJ files, with a "mesh <file>" line in
+// the scene.  Only the "v" and "f" lines are used; faces with more than
+// three corners are split into a fan of triangles.
+
+#include <vector>
+
+#include "Object.h"
+#include "BVH.h"
+#include "Triangle.h"
+
+class MeshFace // A triangle of a mesh: the indices of its corners in the vertex buffer.
+{
+	public:
+		int v[3];
+};
+
+class TrianglePacket // The triangles of a leaf of a mesh, by corner and axis.
+{
+	public:
+		float v[3][3][8];	// v[corner][axis][triangle].  Unused triangles repeat the last one.
+		int   first;		// Index of the first triangle in the faces of the mesh.
+		int   count;		// Triangles in use.
+};
+
+// Tests the ray against the triangles of the packet, leaving their
+// distances in "t", and returns a bit mask of the ones hit closer than
+// max_distance.  Uses AVX if the processor has it.
+int HitTrianglePacket( const TrianglePacket &packet, const WatertightRay &ray, double max_distance, double t[8] );
+
+class MeshNode // A node of the hierarchy of a mesh, stored depth-first.
+{
+	public:
+		float lo[3];	// Bounds, rounded outwards to single precision.
+		float hi[3];
+		int   offset;	// Leaf: index of its packet. Inner node: index of its second child,
+						// the first one is the next node.
+		short count;	// Number of faces in a leaf, 0 for inner nodes.
+		short axis;		// Axis used to split an inner node; the first child is on its lower side.
+};
+
+class TriangleMesh : public Object
+{
+	public:
+		std::vector<Vec3>     vertices;
+		std::vector<MeshFace> faces;	// In the order of the leaves of the hierarchy.
+
+		// Takes the vertices and faces and builds the hierarchy over them.
+		TriangleMesh( std::vector<Vec3> &vertices, std::vector<MeshFace> &faces );
+
+		bool Intersect( const Ray &ray, HitGeom &hitgeom ) const;
+		bool Occludes( const Ray &ray, double max_distance ) const;
+		const Object *Hit( const Ray &ray, HitGeom &hitgeom ) const;
+		void GetHitAttributes( const Ray &ray, HitGeom &hitgeom ) const;
+		Box3 GetBounds() const;
+		unsigned long long Hash( unsigned long long hash ) const;
+		Sample GetSample( const Vec3 &P, const Vec3 &N ) const;
+		double Area() const;
+
+		// Bytes taken by the vertices, faces, hierarchy and packets.
+		size_t MemoryUsed() const;
+
+		// Reads "mesh <file>" lines, loading the OBJ file they name.
+		static Object *ReadString( const char *params );
+
+	private:
+		std::vector<MeshNode>       nodes;
+		std::vector<TrianglePacket> packets;			// One for every leaf.
+		std::vector<float>          cumulative_area;	// Area of the faces up to each one, to pick them for light samples.
+		Box3                        box;
+
+		int BuildNode( std::vector<BVHPrim> &prims, int begin, int end, int depth );
+		int Closest( const Ray &ray, double &distance ) const;
+};
+
+#endif
\ No newline at end of file
@@ -14,12 +14,14 @@
     static const double FourPi   = 4.0 * Pi;
 	static const int NUM_SAMPLES_SQRT =	7;	// Square root of the number of samples
 
+	class Object;
+
 
 	class Interval // An interval of real numbers.
 	{
 		public:
-			double min;
-			double max;
+			Scalar min;
+			Scalar max;
 	};
 
 	class Box3 // A box in R3, useful for bounding boxes.
@@ -30,20 +32,77 @@
 			Interval Z;
 	};
 
+	inline Interval &Along( Box3 &box, int axis ) // Side of the box along axis 0 (X), 1 (Y) or 2 (Z).
+	{
+		return axis == 0 ? box.X : ( axis == 1 ? box.Y : box.Z );
+	}
+
+	inline const Interval &Along( const Box3 &box, int axis )
+	{
+		return axis == 0 ? box.X : ( axis == 1 ? box.Y : box.Z );
+	}
+
+	inline double Component( const Vec3 &v, int axis ) // Coordinate of v along axis 0 (X), 1 (Y) or 2 (Z).
+	{
+		return axis == 0 ? v.x : ( axis == 1 ? v.y : v.z );
+	}
+
+	inline Box3 EmptyBox() // A box that contains nothing, ready to be grown.
+	{
+		Box3 box;
+		box.X.min = box.Y.min = box.Z.min =  Infinity;
+		box.X.max = box.Y.max = box.Z.max = -Infinity;
+		return box;
+	}
+
+	inline Box3 Union( const Box3 &A, const Box3 &B ) // Smallest box containing A and B.
+	{
+		Box3 box;
+		box.X.min = A.X.min < B.X.min ? A.X.min : B.X.min;  box.X.max = A.X.max > B.X.max ? A.X.max : B.X.max;
+		box.Y.min = A.Y.min < B.Y.min ? A.Y.min : B.Y.min;  box.Y.max = A.Y.max > B.Y.max ? A.Y.max : B.Y.max;
+		box.Z.min = A.Z.min < B.Z.min ? A.Z.min : B.Z.min;  box.Z.max = A.Z.max > B.Z.max ? A.Z.max : B.Z.max;
+		return box;
+	}
+
+	inline Box3 Intersection( const Box3 &A, const Box3 &B ) // Largest box inside A and B, empty if they are disjoint.
+	{
+		Box3 box;
+		box.X.min = A.X.min > B.X.min ? A.X.min : B.X.min;  box.X.max = A.X.max < B.X.max ? A.X.max : B.X.max;
+		box.Y.min = A.Y.min > B.Y.min ? A.Y.min : B.Y.min;  box.Y.max = A.Y.max < B.Y.max ? A.Y.max : B.Y.max;
+		box.Z.min = A.Z.min > B.Z.min ? A.Z.min : B.Z.min;  box.Z.max = A.Z.max < B.Z.max ? A.Z.max : B.Z.max;
+		return box;
+	}
+
+	inline Vec3 Center( const Box3 &box ) // Centroid of the box.
+	{
+		return Vec3( 0.5 * ( box.X.min + box.X.max ), 0.5 * ( box.Y.min + box.Y.max ), 0.5 * ( box.Z.min + box.Z.max ) );
+	}
+
+	inline double SurfaceArea( const Box3 &box ) // Area of the six faces, zero for an empty box.
+	{
+		double dx = box.X.max - box.X.min;
+		double dy = box.Y.max - box.Y.min;
+		double dz = box.Z.max - box.Z.min;
+		if( dx < 0.0 || dy < 0.0 || dz < 0.0 ) return 0.0;
+		return 2.0 * ( dx * dy + dy * dz + dz * dx );
+	}
+
 	class HitGeom // Records geometric info for ray-object intersection.
 	{        
 		public:
-			double distance;    // Distance along ray to the point of intersection.
+			Scalar distance;    // Distance along ray to the point of intersection.
 			Vec3   point;       // The point of ray-object intersection.
 			Vec3   normal;      // The surface normal at the point of intersection.
 			Vec3   origin;      // Origin of ray that hit the surface.
+			int           part;     // Part of the object that was hit, such as the face of a mesh or a cube.
+			const Object *object;   // Object that works out the point, normal and origin (see Object::GetHitAttributes).
 	};
 
 	class HitInfo // Records all shading info at ray-object intersection.
 	{     
 		public:
 			HitGeom  geom;      // The geometric information.
-			Material material;  // The material of the surface.
+			unsigned int material_id;  // Index of the material of the surface in the MaterialTable of the scene.
 
     };
 	class Ray // A ray in R3.
@@ -55,16 +114,59 @@
 		};
 
 
+	inline double SafeInverse( double d ) // Inverse of a direction component, finite for axis-aligned rays.
+	{
+		if( fabs( d ) > 1.0E-12 ) return 1.0 / d;
+		return d >= 0.0 ? 1.0E12 : -1.0E12;
+	}
+
+	inline bool HitBox( const Box3 &box, const Vec3 &origin, const Vec3 &inv_dir, double max_distance ) // Slab test: true if the ray enters the box before max_distance.
+	{
+		double t0, t1, tmin = 0.0, tmax = max_distance;
+
+		t0 = ( box.X.min - origin.x ) * inv_dir.x;
+		t1 = ( box.X.max - origin.x ) * inv_dir.x;
+		if( t0 > t1 ) { double t = t0; t0 = t1; t1 = t; }
+		if( t0 > tmin ) tmin = t0;
+		if( t1 < tmax ) tmax = t1;
+
+		t0 = ( box.Y.min - origin.y ) * inv_dir.y;
+		t1 = ( box.Y.max - origin.y ) * inv_dir.y;
+		if( t0 > t1 ) { double t = t0; t0 = t1; t1 = t; }
+		if( t0 > tmin ) tmin = t0;
+		if( t1 < tmax ) tmax = t1;
+
+		t0 = ( box.Z.min - origin.z ) * inv_dir.z;
+		t1 = ( box.Z.max - origin.z ) * inv_dir.z;
+		if( t0 > t1 ) { double t = t0; t0 = t1; t1 = t; }
+		if( t0 > tmin ) tmin = t0;
+		if( t1 < tmax ) tmax = t1;
+
+		return tmin <= tmax;
+	}
+
 	class Sample {         // A point and weight returned from a sampling algorithm.
 		public:
 			Vec3   P;
-			double w;
+			Scalar w;
     };
 	
 	inline double rand( double a, double b )
     {
-		double x = float(rand()) / RAND_MAX;
+		double x = float(rand()) / float(RAND_MAX);
 		if( x < 0.0 ) x = -x;
 		return a + x * ( b - a );
     }
+
+	// Folds "size" bytes into "hash" with FNV-1a.
+	inline unsigned long long HashBytes( unsigned long long hash, const void *data, size_t size )
+	{
+		const unsigned char *bytes = (const unsigned char *)data;
+		for( size_t i = 0; i < size; i++ )
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
 #endif
\ No newline at end of file
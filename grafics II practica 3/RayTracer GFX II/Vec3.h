@@ -4,6 +4,10 @@
 * Vec3 is a trivial encapsulation of 3D floating-point coordinates.        *
 * It has all of the obvious operators defined as inline functions.         *
 *                                                                          *
+* The coordinates are of type Real in Vec3T; Vec3 is the one the renderer  *
+* uses, in the precision chosen in Scalar.h.  Factors and divisors are     *
+* taken as double and rounded to Real before they are applied, so that     *
+* the float build does its vector arithmetic in single precision.          *
 *                                                                          *
 ***************************************************************************/
 #ifndef _VEC3_H_
@@ -12,70 +16,77 @@
 #include <math.h>
 #include <iostream>
 
+#include "Scalar.h"
+
 using namespace std;
 
-struct Vec3 
+template< class Real > struct Vec3T 
 {
-    inline Vec3()                               { x = 0; y = 0; z = 0; }
-    inline Vec3( double a, double b, double c ) { x = a; y = b; z = c; }
-    double x, y, z;
+    inline Vec3T()                               { x = 0; y = 0; z = 0; }
+    inline Vec3T( double a, double b, double c ) { x = Real( a ); y = Real( b ); z = Real( c ); }
+    Real x, y, z;
 };
 
-inline double LengthSquared( const Vec3 &A )
+typedef Vec3T<Scalar> Vec3;
+
+template< class Real > inline Real LengthSquared( const Vec3T<Real> &A )
 {
     return A.x * A.x + A.y * A.y + A.z * A.z;
 }
 
-inline double Length( const Vec3 &A )
+template< class Real > inline Real Length( const Vec3T<Real> &A )
 {
     return sqrt( LengthSquared( A ) );
 }
 
-inline Vec3 operator+( const Vec3 &A, const Vec3 &B )
+template< class Real > inline Vec3T<Real> operator+( const Vec3T<Real> &A, const Vec3T<Real> &B )
 {
-    return Vec3( A.x + B.x, A.y + B.y, A.z + B.z );
+    return Vec3T<Real>( A.x + B.x, A.y + B.y, A.z + B.z );
 }
 
-inline Vec3 operator-( const Vec3 &A, const Vec3 &B )
+template< class Real > inline Vec3T<Real> operator-( const Vec3T<Real> &A, const Vec3T<Real> &B )
 {
-    return Vec3( A.x - B.x, A.y - B.y, A.z - B.z );
+    return Vec3T<Real>( A.x - B.x, A.y - B.y, A.z - B.z );
 }
 
-inline Vec3 operator-( const Vec3 &A )  // Unary minus.
+template< class Real > inline Vec3T<Real> operator-( const Vec3T<Real> &A )  // Unary minus.
 {
-    return Vec3( -A.x, -A.y, -A.z );
+    return Vec3T<Real>( -A.x, -A.y, -A.z );
 }
 
-inline Vec3 operator*( double a, const Vec3 &A )
+template< class Real > inline Vec3T<Real> operator*( double a, const Vec3T<Real> &A )
 {
-    return Vec3( a * A.x, a * A.y, a * A.z );
+    Real r = Real( a );
+    return Vec3T<Real>( r * A.x, r * A.y, r * A.z );
 }
 
-inline Vec3 operator*( const Vec3 &A, double a )
+template< class Real > inline Vec3T<Real> operator*( const Vec3T<Real> &A, double a )
 {
-    return Vec3( a * A.x, a * A.y, a * A.z );
+    Real r = Real( a );
+    return Vec3T<Real>( r * A.x, r * A.y, r * A.z );
 }
 
-inline double operator*( const Vec3 &A, const Vec3 &B )  // Inner product.
+template< class Real > inline Real operator*( const Vec3T<Real> &A, const Vec3T<Real> &B )  // Inner product.
 {
     return (A.x * B.x) + (A.y * B.y) + (A.z * B.z);
 }
 
-inline Vec3 operator/( const Vec3 &A, double c )
+template< class Real > inline Vec3T<Real> operator/( const Vec3T<Real> &A, double c )
 {
-    return Vec3( A.x / c, A.y / c, A.z / c );
+    Real r = Real( c );
+    return Vec3T<Real>( A.x / r, A.y / r, A.z / r );
 }
 
-inline Vec3 operator^( const Vec3 &A, const Vec3 &B ) // Cross product.
+template< class Real > inline Vec3T<Real> operator^( const Vec3T<Real> &A, const Vec3T<Real> &B ) // Cross product.
 {
-    return Vec3( 
+    return Vec3T<Real>( 
         A.y * B.z - A.z * B.y,
         A.z * B.x - A.x * B.z,
         A.x * B.y - A.y * B.x
         );
 }
 
-inline Vec3& operator+=( Vec3 &A, const Vec3 &B )
+template< class Real > inline Vec3T<Real> &operator+=( Vec3T<Real> &A, const Vec3T<Real> &B )
 {
     A.x += B.x;
     A.y += B.y;
@@ -83,7 +94,7 @@ inline Vec3& operator+=( Vec3 &A, const Vec3 &B )
     return A;
 }
 
-inline Vec3& operator-=( Vec3 &A, const Vec3 &B )
+template< class Real > inline Vec3T<Real> &operator-=( Vec3T<Real> &A, const Vec3T<Real> &B )
 {
     A.x -= B.x;
     A.y -= B.y;
@@ -91,52 +102,54 @@ inline Vec3& operator-=( Vec3 &A, const Vec3 &B )
     return A;
 }
 
-inline Vec3 &operator*=( Vec3 &A, double a )
+template< class Real > inline Vec3T<Real> &operator*=( Vec3T<Real> &A, double a )
 {
-    A.x *= a;
-    A.y *= a;
-    A.z *= a;
+    Real r = Real( a );
+    A.x *= r;
+    A.y *= r;
+    A.z *= r;
     return A;
 }
 
-inline Vec3& operator/=( Vec3 &A, double a )
+template< class Real > inline Vec3T<Real> &operator/=( Vec3T<Real> &A, double a )
 {
-    A.x /= a;
-    A.y /= a;
-    A.z /= a;
+    Real r = Real( a );
+    A.x /= r;
+    A.y /= r;
+    A.z /= r;
     return A;
 }
 
-inline Vec3 operator/( const Vec3 &A, const Vec3 &B )  // Remove component parallel to B.
+template< class Real > inline Vec3T<Real> operator/( const Vec3T<Real> &A, const Vec3T<Real> &B )  // Remove component parallel to B.
 {
-    double x = LengthSquared( B );
+    Real x = LengthSquared( B );
     if( x > 0.0 ) return A - (( A * B ) / x) * B;
 	return A;
 }
 
-inline Vec3 Unit( const Vec3 &A )
+template< class Real > inline Vec3T<Real> Unit( const Vec3T<Real> &A )
 {
-    double d = LengthSquared( A );
-    return d > 0.0 ? A / sqrt(d) : Vec3(0,0,0);
+    Real d = LengthSquared( A );
+    return d > 0.0 ? A / sqrt(d) : Vec3T<Real>(0,0,0);
 }
 
-inline double dist( const Vec3 &A, const Vec3 &B ) // Euclidean distance from A to B.
+template< class Real > inline Real dist( const Vec3T<Real> &A, const Vec3T<Real> &B ) // Euclidean distance from A to B.
 { 
     return Length( A - B ); 
 }
 
-inline ostream &operator<<( ostream &out, const Vec3 &A )
+template< class Real > inline ostream &operator<<( ostream &out, const Vec3T<Real> &A )
 {
     out << "( " << A.x << ", " << A.y << ", " << A.z << " ) ";
     return out;
 }
 
-inline Vec3 Reflection( const Vec3 &V, const Vec3 &N )
+template< class Real > inline Vec3T<Real> Reflection( const Vec3T<Real> &V, const Vec3T<Real> &N )
 {
 	return V - 2 * N * ( N * V );
 }
 
-inline Vec3 Refraction( const Vec3 &V, const Vec3 &N, double eta )
+template< class Real > inline Vec3T<Real> Refraction( const Vec3T<Real> &V, const Vec3T<Real> &N, double eta )
 {
 	double cos_in, cos_out_sq;
 
@@ -146,17 +159,28 @@ inline Vec3 Refraction( const Vec3 &V, const Vec3 &N, double eta )
 	// If cs2 < 0 --> Total Internal Reflection (no reflectivity)
 	if( cos_out_sq < 0 )
 	{
-		return Vec3();
+		return Vec3T<Real>();
 	}
 
 	return V / eta - ( sqrt( cos_out_sq ) - cos_in / eta ) * N;
 }
 
-inline int insideRectangle (Vec3 Point, Vec3 Corners[4]) // Return true if the point is inside a rectangle
+// Completes the unit vector W with U and V to an orthonormal basis, with no
+// trigonometry and no branch but the sign of W.z (Duff et al., 2017).
+template< class Real > inline void OrthonormalBasis( const Vec3T<Real> &W, Vec3T<Real> &U, Vec3T<Real> &V )
+{
+	Real sign = W.z >= 0 ? Real( 1 ) : Real( -1 );
+	Real a = -1 / ( sign + W.z );
+	Real b = W.x * W.y * a;
+	U = Vec3T<Real>( 1 + sign * W.x * W.x * a, sign * b, -sign * W.x );
+	V = Vec3T<Real>( b, sign + W.y * W.y * a, -W.y );
+}
+
+template< class Real > inline int insideRectangle (Vec3T<Real> Point, Vec3T<Real> Corners[4]) // Return true if the point is inside a rectangle
 {
 	int i;
-	Vec3 CornerToCorner;
-	Vec3 CornerToPoint;
+	Vec3T<Real> CornerToCorner;
+	Vec3T<Real> CornerToPoint;
 
 	for (i=0; i<4; i++)
 	{
@@ -0,0 +1,417 @@
+#include <chrono>
+#include <immintrin.h>
+
+#include "WideBVH.h"
+#include "Cpu.h"
+#include "Cache.h"
+
+static const int StackSize = 64 * 8;	// Depth of the binary tree times the children pushed per level
+
+// Slab test of one ray against four boxes whose rows are "stride" floats
+// apart.  Returns a bit mask of the boxes hit and their entry distances.
+static inline int HitBoxesSSE( const float *box, int stride, const WideRay &ray, float tmax, float *tnear )
+{
+	__m128 tn, tf;
+
+	tn = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( box + ray.near_row[0] * stride ), _mm_set1_ps( ray.origin[0] ) ), _mm_set1_ps( ray.inv_dir[0] ) );
+	tf = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( box + ray.far_row[0]  * stride ), _mm_set1_ps( ray.origin[0] ) ), _mm_set1_ps( ray.inv_dir[0] ) );
+	tn = _mm_max_ps( tn, _mm_setzero_ps() );
+	tf = _mm_min_ps( tf, _mm_set1_ps( tmax ) );
+
+	tn = _mm_max_ps( tn, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( box + ray.near_row[1] * stride ), _mm_set1_ps( ray.origin[1] ) ), _mm_set1_ps( ray.inv_dir[1] ) ) );
+	tf = _mm_min_ps( tf, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( box + ray.far_row[1]  * stride ), _mm_set1_ps( ray.origin[1] ) ), _mm_set1_ps( ray.inv_dir[1] ) ) );
+
+	tn = _mm_max_ps( tn, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( box + ray.near_row[2] * stride ), _mm_set1_ps( ray.origin[2] ) ), _mm_set1_ps( ray.inv_dir[2] ) ) );
+	tf = _mm_min_ps( tf, _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( box + ray.far_row[2]  * stride ), _mm_set1_ps( ray.origin[2] ) ), _mm_set1_ps( ray.inv_dir[2] ) ) );
+
+	// A few ulps of slack on the exit distance absorb the rounding of the products.
+	tf = _mm_mul_ps( tf, _mm_set1_ps( 1.0000005f ) );
+
+	_mm_storeu_ps( tnear, tn );
+	return _mm_movemask_ps( _mm_cmple_ps( tn, tf ) );
+}
+
+// The same test on eight boxes at once.
+static TARGET_AVX int HitBoxesAVX( const float *box, const WideRay &ray, float tmax, float *tnear )
+{
+	__m256 tn, tf;
+
+	tn = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( box + ray.near_row[0] * 8 ), _mm256_set1_ps( ray.origin[0] ) ), _mm256_set1_ps( ray.inv_dir[0] ) );
+	tf = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( box + ray.far_row[0]  * 8 ), _mm256_set1_ps( ray.origin[0] ) ), _mm256_set1_ps( ray.inv_dir[0] ) );
+	tn = _mm256_max_ps( tn, _mm256_setzero_ps() );
+	tf = _mm256_min_ps( tf, _mm256_set1_ps( tmax ) );
+
+	tn = _mm256_max_ps( tn, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( box + ray.near_row[1] * 8 ), _mm256_set1_ps( ray.origin[1] ) ), _mm256_set1_ps( ray.inv_dir[1] ) ) );
+	tf = _mm256_min_ps( tf, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( box + ray.far_row[1]  * 8 ), _mm256_set1_ps( ray.origin[1] ) ), _mm256_set1_ps( ray.inv_dir[1] ) ) );
+
+	tn = _mm256_max_ps( tn, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( box + ray.near_row[2] * 8 ), _mm256_set1_ps( ray.origin[2] ) ), _mm256_set1_ps( ray.inv_dir[2] ) ) );
+	tf = _mm256_min_ps( tf, _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( box + ray.far_row[2]  * 8 ), _mm256_set1_ps( ray.origin[2] ) ), _mm256_set1_ps( ray.inv_dir[2] ) ) );
+
+	tf = _mm256_mul_ps( tf, _mm256_set1_ps( 1.0000005f ) );
+
+	_mm256_storeu_ps( tnear, tn );
+	return _mm256_movemask_ps( _mm256_cmp_ps( tn, tf, _CMP_LE_OQ ) );
+}
+
+static inline int HitBoxes( const WideNode<4> &node, const WideRay &ray, float tmax, float *tnear )
+{
+	return HitBoxesSSE( &node.box[0][0], 4, ray, tmax, tnear );
+}
+
+static inline int HitBoxes( const WideNode<8> &node, const WideRay &ray, float tmax, float *tnear )
+{
+	if( CpuHasAVX() ) return HitBoxesAVX( &node.box[0][0], ray, tmax, tnear );
+
+	// Without AVX, two SSE tests on each half of the node.
+	return HitBoxesSSE( &node.box[0][0], 8, ray, tmax, tnear ) |
+		 ( HitBoxesSSE( &node.box[0][4], 8, ray, tmax, tnear + 4 ) << 4 );
+}
+
+template <int W>
+void WideBVH<W>::Build( Object *first )
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	BVH binary( BVH_BINNED );
+
+	nodes.clear();
+	objects.clear();
+
+	binary.Build( first );
+	if( binary.NumNodes() == 0 ) return;
+
+	objects.resize( binary.NumObjects() );
+	for( int i = 0; i < binary.NumObjects(); i++ ) objects[i] = binary.GetObject( i );
+	primitives.Compile( objects );
+	Collapse( binary, 0 );
+
+	build_time = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+	build_cost = Cost();
+}
+
+// Stores the box of child i of the node, rounded outwards to floats.
+template <int W>
+static inline void SetChildBox( WideNode<W> &node, int i, const Box3 &box )
+{
+	node.box[0][i] = RoundDown( box.X.min );  node.box[1][i] = RoundUp( box.X.max );
+	node.box[2][i] = RoundDown( box.Y.min );  node.box[3][i] = RoundUp( box.Y.max );
+	node.box[4][i] = RoundDown( box.Z.min );  node.box[5][i] = RoundUp( box.Z.max );
+}
+
+// Box of child i of the node, back in double precision.
+template <int W>
+static inline Box3 GetChildBox( const WideNode<W> &node, int i )
+{
+	Box3 box;
+	box.X.min = node.box[0][i];  box.X.max = node.box[1][i];
+	box.Y.min = node.box[2][i];  box.Y.max = node.box[3][i];
+	box.Z.min = node.box[4][i];  box.Z.max = node.box[5][i];
+	return box;
+}
+
+// The nodes below a node are always stored after it, as in the binary tree,
+// so walking the array backwards refits the children of a node before it.
+template <int W>
+void WideBVH<W>::Refit()
+{
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+	for( int n = NumNodes() - 1; n >= 0; n-- )
+	{
+		WideNode<W> &node = nodes[n];
+		for( int i = 0; i < W; i++ )
+		{
+			if( node.count[i] < 0 ) continue;
+
+			if( node.count[i] > 0 )
+			{
+				Box3 box = EmptyBox();
+				for( int j = node.child[i]; j < node.child[i] + node.count[i]; j++ )
+					box = Union( box, objects[j]->GetBounds() );
+				SetChildBox( node, i, box );
+			}
+			else
+			{
+				// The boxes of the grandchildren are already rounded, so
+				// their union is taken directly in floats.
+				const WideNode<W> &c = nodes[node.child[i]];
+				for( int row = 0; row < 6; row += 2 )
+				{
+					float lo =  HUGE_VALF;
+					float hi = -HUGE_VALF;
+					for( int k = 0; k < W; k++ )
+					{
+						if( c.count[k] < 0 ) continue;
+						if( c.box[row][k]     < lo ) lo = c.box[row][k];
+						if( c.box[row + 1][k] > hi ) hi = c.box[row + 1][k];
+					}
+					node.box[row][i]     = lo;
+					node.box[row + 1][i] = hi;
+				}
+			}
+		}
+	}
+	primitives.Compile( objects );
+
+	refit_time = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+}
+
+// Same measure as BVH::Cost: the areas of the child boxes weighted by the
+// work they cost, over the areas of the objects.
+template <int W>
+double WideBVH<W>::Cost() const
+{
+	double cost = 0.0;
+	double object_area = 0.0;
+
+	if( nodes.empty() ) return 0.0;
+
+	Box3 root = EmptyBox();
+	for( int i = 0; i < W; i++ )
+		if( nodes[0].count[i] >= 0 ) root = Union( root, GetChildBox( nodes[0], i ) );
+	cost = TraversalCost * SurfaceArea( root );
+
+	for( int n = 0; n < NumNodes(); n++ )
+	{
+		for( int i = 0; i < W; i++ )
+		{
+			int count = nodes[n].count[i];
+			if( count < 0 ) continue;
+			double work = count > 0 ? IntersectCost * count : TraversalCost;
+			cost += SurfaceArea( GetChildBox( nodes[n], i ) ) * work;
+		}
+	}
+	for( size_t i = 0; i < objects.size(); i++ ) object_area += SurfaceArea( objects[i]->GetBounds() );
+	return object_area > 0.0 ? cost / object_area : cost;
+}
+
+// Creates the wide node that replaces the binary node "index" and the
+// subtree below it.  Returns the index of the new node.
+template <int W>
+int WideBVH<W>::Collapse( const BVH &binary, int index )
+{
+	WideNode<W> wide = WideNode<W>();
+	int children[W];
+	int n = 0;
+
+	const BVHNode &node = binary.GetNode( index );
+	if( node.count > 0 )
+	{
+		// A tree made of a single leaf.
+		children[n++] = index;
+	}
+	else
+	{
+		children[n++] = node.first;
+		children[n++] = node.offset;
+	}
+
+	// Replace the inner child with the largest box by its two children
+	// until the node is full or all the children are leaves.
+	while( n < W )
+	{
+		int    best = -1;
+		double best_area = -1.0;
+		for( int i = 0; i < n; i++ )
+		{
+			const BVHNode &c = binary.GetNode( children[i] );
+			if( c.count == 0 && SurfaceArea( c.box ) > best_area )
+			{
+				best = i;
+				best_area = SurfaceArea( c.box );
+			}
+		}
+		if( best < 0 ) break;
+		int opened = children[best];
+		children[best] = binary.GetNode( opened ).first;
+		children[n++]  = binary.GetNode( opened ).offset;
+	}
+
+	int result = (int)nodes.size();
+	nodes.push_back( wide );
+
+	for( int i = 0; i < W; i++ )
+	{
+		if( i >= n )
+		{
+			// Unused slot, an empty box that no ray can hit.
+			wide.box[0][i] = wide.box[2][i] = wide.box[4][i] =  HUGE_VALF;
+			wide.box[1][i] = wide.box[3][i] = wide.box[5][i] = -HUGE_VALF;
+			wide.child[i] = 0;
+			wide.count[i] = -1;
+			continue;
+		}
+		const BVHNode &c = binary.GetNode( children[i] );
+		SetChildBox( wide, i, c.box );
+		if( c.count > 0 )
+		{
+			wide.child[i] = c.offset;
+			wide.count[i] = c.count;
+		}
+		else
+		{
+			wide.child[i] = Collapse( binary, children[i] );
+			wide.count[i] = 0;
+		}
+	}
+
+	nodes[result] = wide;
+	return result;
+}
+
+template <int W>
+const Object *WideBVH<W>::Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore ) const
+{
+	QueryCount work;
+	const Object *hit = NULL;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( nodes.empty() ) return NULL;
+
+	WideRay r( ray );
+
+	for(;;)
+	{
+		const WideNode<W> &node = nodes[current];
+		work.nodes++;
+		float tnear[W];
+		int   inner[W];
+		int   num_inner = 0;
+
+		int mask = HitBoxes( node, r, RoundUp( hitgeom.distance ), tnear );
+
+		for( int i = 0; i < W; i++ )
+		{
+			if( ( mask & ( 1 << i ) ) == 0 ) continue;
+
+			if( node.count[i] > 0 )
+			{
+				// Leaves are intersected right away, shortening the ray for the rest.
+				for( int j = node.child[i]; j < node.child[i] + node.count[i]; j++ )
+				{
+					work.primitives++;
+					const Object *object = primitives.Hit( j, ray, hitgeom, ignore );
+					if( object != NULL ) hit = object;
+				}
+			}
+			else
+			{
+				// Keep the inner children sorted by decreasing entry distance,
+				// so that the nearest one ends up on top of the stack.
+				int k = num_inner++;
+				while( k > 0 && tnear[inner[k - 1]] < tnear[i] )
+				{
+					inner[k] = inner[k - 1];
+					k--;
+				}
+				inner[k] = i;
+			}
+		}
+
+		for( int k = 0; k < num_inner; k++ )
+		{
+			if( tnear[inner[k]] <= hitgeom.distance ) stack[sp++] = node.child[inner[k]];
+		}
+
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return hit;
+}
+
+template <int W>
+bool WideBVH<W>::Occluded( const Ray &ray, double max_distance, const Object *ignore ) const
+{
+	QueryCount work;
+	int stack[StackSize];
+	int sp = 0;
+	int current = 0;
+
+	if( nodes.empty() ) return false;
+
+	WideRay r( ray );
+	float tmax = RoundUp( max_distance );
+
+	for(;;)
+	{
+		const WideNode<W> &node = nodes[current];
+		work.nodes++;
+		float tnear[W];
+
+		// No ordering by distance: any blocker ends the search.
+		int mask = HitBoxes( node, r, tmax, tnear );
+		for( int i = 0; i < W; i++ )
+		{
+			if( ( mask & ( 1 << i ) ) == 0 ) continue;
+
+			if( node.count[i] > 0 )
+			{
+				for( int j = node.child[i]; j < node.child[i] + node.count[i]; j++ )
+				{
+					work.primitives++;
+					if( primitives.Occludes( j, ray, max_distance, ignore ) ) return true;
+				}
+			}
+			else stack[sp++] = node.child[i];
+		}
+
+		if( sp == 0 ) break;
+		current = stack[--sp];
+	}
+	return false;
+}
+
+// Leaf children count one level below their node.
+template <int W>
+void WideBVH<W>::GetTreeStats( TreeStats &stats ) const
+{
+	std::vector< std::pair<int, int> > stack;	// Nodes left to visit, with their depth.
+
+	if( !nodes.empty() ) stack.push_back( std::make_pair( 0, 0 ) );
+	while( !stack.empty() )
+	{
+		const WideNode<W> &node = nodes[stack.back().first];
+		int depth = stack.back().second;
+		stack.pop_back();
+
+		for( int i = 0; i < W; i++ )
+		{
+			if( node.count[i] > 0 ) stats.AddLeaf( node.count[i], depth + 1 );
+			else if( node.count[i] == 0 ) stack.push_back( std::make_pair( node.child[i], depth + 1 ) );
+		}
+	}
+}
+
+template <int W>
+bool WideBVH<W>::Save( const char *file_name, unsigned long long key, Object *first ) const
+{
+	return SaveNodes( file_name, Name(), key, nodes, objects, first );
+}
+
+template <int W>
+bool WideBVH<W>::Load( const char *file_name, unsigned long long key, Object *first )
+{
+	if( !LoadNodes( file_name, Name(), key, nodes, objects, first ) ) return false;
+
+	primitives.Compile( objects );
+	build_cost = Cost();
+	return true;
+}
+
+template <int W>
+const char *WideBVH<W>::Name() const
+{
+	return W == 4 ? "bvh4" : "bvh8";
+}
+
+template <int W>
+void WideBVH<W>::Report( ostream &out ) const
+{
+	out << W << "-wide BVH built in " << build_time * 1000.0 << " ms: "
+		<< NumNodes() << " nodes over " << objects.size() << " objects, box tests with "
+		<< ( W == 8 && CpuHasAVX() ? "AVX" : "SSE" ) << ", SAH cost " << build_cost << "." << endl;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
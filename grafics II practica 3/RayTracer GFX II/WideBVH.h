@@ -0,0 +1,112 @@
+#ifndef WIDEBVH_H
+#define WIDEBVH_H
+
+/***************************************************************************
+*                                                                          *
+* This file defines a wide bounding volume hierarchy, where every node has *
+* up to W children (W = 4 for a QBVH, W = 8 for an OBVH).  It is obtained  *
+* by collapsing a binary BVH: the children of a node are repeatedly        *
+* replaced by their own children, largest box first, until there are W.    *
+*                                                                          *
+* The boxes of the W children are stored as single precision floats in     *
+* structure-of-arrays form (all the X minimums, then all the X maximums,   *
+* and so on), so a ray is tested against all of them at once with SSE      *
+* (4 wide) or AVX (8 wide) instructions.  The floats are rounded outwards  *
+* so that the boxes stay conservative; the objects themselves are still    *
+* intersected in double precision.                                         *
+*                                                                          *
+***************************************************************************/
+
+#include <math.h>
+#include <vector>
+
+#include "BVH.h"
+
+// The ray in the single precision form used by the box tests.
+class WideRay
+{
+	public:
+		float origin[3];
+		float inv_dir[3];
+		int   near_row[3];	// Row of WideNode::box holding the entry plane on each axis.
+		int   far_row[3];	// Row holding the exit plane.
+
+		WideRay( const Ray &ray )
+		{
+			origin[0]  = (float)ray.origin.x;
+			origin[1]  = (float)ray.origin.y;
+			origin[2]  = (float)ray.origin.z;
+			inv_dir[0] = (float)SafeInverse( ray.direction.x );
+			inv_dir[1] = (float)SafeInverse( ray.direction.y );
+			inv_dir[2] = (float)SafeInverse( ray.direction.z );
+			for( int a = 0; a < 3; a++ )
+			{
+				near_row[a] = 2 * a + ( inv_dir[a] < 0.0f ? 1 : 0 );
+				far_row[a]  = 2 * a + ( inv_dir[a] < 0.0f ? 0 : 1 );
+			}
+		}
+};
+
+// Converts a bound to float, moving it outwards so that the rounding of the
+// bound and of the ray origin can never make the box miss a ray it contains.
+inline float RoundDown( double v )
+{
+	v -= 1.0E-6 * ( 1.0 + fabs( v ) );
+	float f = (float)v;
+	return f > v ? nextafterf( f, -HUGE_VALF ) : f;
+}
+
+inline float RoundUp( double v )
+{
+	v += 1.0E-6 * ( 1.0 + fabs( v ) );
+	float f = (float)v;
+	return f < v ? nextafterf( f, HUGE_VALF ) : f;
+}
+
+template <int W>
+class WideNode // A node with up to W children.
+{
+	public:
+		float box[6][W];	// Child bounds: min X, max X, min Y, max Y, min Z, max Z.
+		int   child[W];		// Leaf child: index of its first object. Inner child: index of its node.
+		int   count[W];		// Objects in a leaf child, 0 for an inner child, -1 for an unused slot.
+};
+
+template <int W>
+class WideBVH : public Accelerator
+{
+	public:
+		WideBVH() {}
+		virtual ~WideBVH() {}
+
+		void Build( Object *first );
+		const Object *Intersect( const Ray &ray, HitGeom &hitgeom, const Object *ignore = NULL ) const;
+		bool Occluded( const Ray &ray, double max_distance, const Object *ignore = NULL ) const;
+		void Refit();
+		double Cost() const;
+		bool Cacheable() const { return true; }
+		bool Save( const char *file_name, unsigned long long key, Object *first ) const;
+		bool Load( const char *file_name, unsigned long long key, Object *first );
+		const char *Name() const;
+		void Report( ostream &out ) const;
+		void GetTreeStats( TreeStats &stats ) const;
+
+		int NumNodes() const { return (int)nodes.size(); }
+		int NumObjects() const { return (int)objects.size(); }
+
+		// Read access for the structures that are derived from a wide tree.
+		const WideNode<W> &GetNode( int i ) const { return nodes[i]; }
+		Object *GetObject( int i ) const { return objects[i]; }
+
+	private:
+		NodeArray< WideNode<W> > nodes;
+		std::vector<Object*>       objects;	// Objects referenced by the leaves, in the order of the binary tree.
+		Primitives                 primitives;	// The same objects compiled, which the leaves test.
+
+		int Collapse( const BVH &binary, int index );
+};
+
+typedef WideBVH<4> QBVH;
+typedef WideBVH<8> OBVH;
+
+#endif
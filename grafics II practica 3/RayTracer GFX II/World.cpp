@@ -1,10 +1,251 @@
+#include <chrono>
+#include <string>
+
 #include "World.h"
+#include "Cache.h"
+#include "BVH.h"
+#include "PerfCounters.h"
 
-bool World::readScene( const char *filename )
+// Reads the scene and builds the accelerator named "accel" over its
+// objects.  When it is NULL, the one given in the scene file is used, and
+// a plain BVH if the file does not name any.  With "use_cache", the
+// accelerator is loaded from "<filename>.<accel>.cache" if that file was
+// written for the same objects, and written there after building it
+// otherwise.
+bool World::readScene( const char *filename, const char *accel, bool use_cache )
 {
 	Reader r;
 	
-	return r.ReadSceneDescription( filename , sce , cam );
+	if( !r.ReadSceneDescription( filename , sce , cam ) ) return false;
+
+	sce.lights = new LightTree();
+	sce.lights->Build( sce.first, *sce.materials );
+	if( sce.lights->NumLights() > 0 ) cout << "Light tree built over " << sce.lights->NumLights() << " emitters." << endl;
+
+	if( accel == NULL ) accel = sce.accel_name[0] != 0 ? sce.accel_name : "bvh";
+	sce.accel = Accelerator::Create( accel );
+	if( sce.accel == NULL )
+	{
+		cerr << "Unknown accelerator " << accel << endl;
+		return false;
+	}
+
+	std::string cache_file = std::string( filename ) + "." + accel + ".cache";
+	if( !sce.accel->Cacheable() ) use_cache = false;
+	unsigned long long key = use_cache ? SceneHash( sce.first ) : 0;
+
+	if( use_cache )
+	{
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		if( sce.accel->Load( cache_file.c_str(), key, sce.first ) )
+		{
+			double seconds = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+			cout << "Acceleration structure loaded from " << cache_file << " in " << seconds * 1000.0 << " ms." << endl;
+			return true;
+		}
+	}
+
+	// All the objects are known now, build the structure used to cast rays
+	sce.accel->Build( sce.first );
+	sce.accel->Report( cout );
+
+	if( use_cache && !sce.accel->Save( cache_file.c_str(), key, sce.first ) )
+		cerr << "Could not write " << cache_file << endl;
+	return true;
+}
+
+// To be called after moving objects of the scene, for instance between the
+// frames of an animation.  The accelerator is refitted to the new bounds,
+// or rebuilt if the refit has left it too loose, in which case it returns
+// true.  The light tree is small and always built again.
+bool World::updateScene( void )
+{
+	sce.lights->Build( sce.first, *sce.materials );
+	if( sce.accel->Update( sce.first ) )
+	{
+		cout << "Acceleration structure rebuilt: ";
+		sce.accel->Report( cout );
+		return true;
+	}
+	cout << "Acceleration structure refitted in " << sce.accel->refit_time * 1000.0 << " ms, SAH cost "
+		 << sce.accel->Cost() << " (" << sce.accel->build_cost << " after the build)." << endl;
+	return false;
+}
+
+// Animates the scene for the given number of frames through updateScene.
+// Every sphere and cube drifts along a random direction of its own, a
+// hundredth of the size of the scene per frame, so the boxes of the
+// accelerator grow looser until the growth of its SAH cost makes it
+// rebuild.  The rest of the objects stay where they are.
+void World::benchmarkAnimation( int frames )
+{
+	std::vector<Sphere*> spheres;
+	std::vector<Cube*>   cubes;
+	std::vector<Vec3>    steps;	// Move of every sphere, then of every cube, per frame.
+	Box3 bounds = EmptyBox();
+
+	for( Object *object = sce.first; object != NULL; object = object->next )
+	{
+		bounds = Union( bounds, object->GetBounds() );
+		Sphere *sphere = dynamic_cast<Sphere*>( object );
+		Cube   *cube   = dynamic_cast<Cube*>( object );
+		if( sphere != NULL ) spheres.push_back( sphere );
+		else if( cube != NULL ) cubes.push_back( cube );
+	}
+	if( spheres.empty() && cubes.empty() )
+	{
+		cout << "The scene has no spheres or cubes to move." << endl;
+		return;
+	}
+
+	double step = 0.01 * Length( Vec3( bounds.X.max - bounds.X.min, bounds.Y.max - bounds.Y.min, bounds.Z.max - bounds.Z.min ) );
+	for( size_t i = 0; i < spheres.size() + cubes.size(); i++ )
+		steps.push_back( step * Unit( Vec3( rand( -1.0, 1.0 ), rand( -1.0, 1.0 ), rand( -1.0, 1.0 ) ) ) );
+
+	int rebuilds = 0;
+	double seconds = 0.0;
+	cout << "Moving " << spheres.size() << " spheres and " << cubes.size() << " cubes for " << frames << " frames." << endl;
+	for( int f = 1; f <= frames; f++ )
+	{
+		for( size_t i = 0; i < spheres.size(); i++ ) spheres[i]->center = spheres[i]->center + steps[i];
+		for( size_t i = 0; i < cubes.size(); i++ )
+		{
+			const Vec3 &move = steps[spheres.size() + i];
+			cubes[i]->Min = cubes[i]->Min + move;
+			cubes[i]->Max = cubes[i]->Max + move;
+		}
+
+		cout << "Frame " << f << ": ";
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		if( updateScene() ) rebuilds++;
+		seconds += std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+	}
+	cout << rebuilds << " rebuilds in " << frames << " frames, " << seconds * 1000.0 / frames << " ms per update." << endl;
+}
+
+// Traces the same rays through a BVH of the scene stored in each layout,
+// and reports the time and, where the hardware counters can be read, the
+// data cache misses of each one.  The rays are those from the eye through
+// a width x height raster, plus a bounce in a random direction from every
+// hit, which touch the nodes much less coherently.
+void World::benchmarkLayouts( int width, int height )
+{
+	static const BVHLayout   layouts[]      = { BVH_LAYOUT_BUILD, BVH_LAYOUT_DFS, BVH_LAYOUT_VEB };
+	static const char *const layout_names[] = { "depth-first", "larger child first", "van Emde Boas" };
+	std::vector<Ray> rays;
+	BVH bvh;
+
+	bvh.Build( sce.first );
+
+	Vec3 G  = Unit( cam.lookat - cam.eye );
+	Vec3 U  = Unit( cam.up / G );
+	Vec3 R  = Unit( G ^ U );
+	Vec3 O  = ( cam.vpdist * G ) - R + U;
+	Vec3 dU = U * ( 2.0 / ( height - 1 ) );
+	Vec3 dR = R * ( 2.0 / ( width - 1 ) );
+
+	for( int j = 0; j < height; j++ )
+	{
+		for( int i = 0; i < width; i++ )
+		{
+			Ray ray;
+			ray.origin = cam.eye;
+			ray.direction = Unit( O + i * dR - j * dU );
+			ray.no_emitters = false;
+			rays.push_back( ray );
+
+			HitGeom hitgeom;
+			hitgeom.distance = Infinity;
+			if( bvh.Intersect( ray, hitgeom ) == NULL ) continue;
+			hitgeom.object->GetHitAttributes( ray, hitgeom );
+
+			// Leave the surface as Shade does, so the bounce cannot hit it again at zero distance.
+			Ray bounce;
+			bounce.origin = hitgeom.point + Epsilon * hitgeom.normal;
+			bounce.direction = Unit( Vec3( rand( -1.0, 1.0 ), rand( -1.0, 1.0 ), rand( -1.0, 1.0 ) ) );
+			bounce.no_emitters = false;
+			rays.push_back( bounce );
+		}
+	}
+
+	cout << "Tracing " << rays.size() << " rays through " << bvh.NumNodes() << " nodes." << endl;
+	for( int l = 0; l < 3; l++ )
+	{
+		CacheCounters counters;
+		int hits = 0;
+
+		bvh.Reorder( layouts[l] );
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		counters.Start();
+		for( size_t i = 0; i < rays.size(); i++ )
+		{
+			HitGeom hitgeom;
+			hitgeom.distance = Infinity;
+			if( bvh.Intersect( rays[i], hitgeom ) != NULL ) hits++;
+		}
+		counters.Stop();
+		double seconds = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+
+		cout << layout_names[l] << ": " << seconds * 1000.0 << " ms, " << hits << " hits";
+		if( counters.Available() )
+			cout << ", " << counters.l1_misses << " L1 data misses, " << counters.llc_misses << " last level cache misses";
+		else cout << ", cache miss counters not available";
+		cout << "." << endl;
+	}
+}
+
+// Times each triangle kernel on the same pairs of rays and triangles of
+// the scene.  Every ray leaves the eye towards a random point near its
+// triangle, in the plane of the triangle, so about a quarter of them hit.
+void World::benchmarkTriangles( int tests )
+{
+	static const TriangleKernel kernels[]      = { TRIANGLE_BARYCENTRIC, TRIANGLE_MOLLER_TRUMBORE, TRIANGLE_WATERTIGHT };
+	static const char *const    kernel_names[] = { "barycentric", "Moller-Trumbore", "watertight" };
+	std::vector<const Triangle*> triangles;
+	std::vector<Ray> rays;
+
+	for( Object *object = sce.first; object != NULL; object = object->next )
+	{
+		const Triangle *triangle = dynamic_cast<const Triangle*>( object );
+		if( triangle != NULL ) triangles.push_back( triangle );
+	}
+	if( triangles.empty() )
+	{
+		cout << "The scene has no triangles to test." << endl;
+		return;
+	}
+
+	for( int i = 0; i < tests; i++ )
+	{
+		const Triangle *triangle = triangles[i % triangles.size()];
+		Vec3 target = triangle->A + rand( -0.2, 1.2 ) * triangle->E1 + rand( -0.2, 1.2 ) * triangle->E2;
+		Ray ray;
+		ray.origin = cam.eye;
+		ray.direction = Unit( target - cam.eye );
+		ray.no_emitters = false;
+		rays.push_back( ray );
+	}
+
+	TriangleKernel kernel = Triangle::kernel;
+	cout << "Testing " << tests << " rays against " << triangles.size() << " triangles." << endl;
+	for( int k = 0; k < 3; k++ )
+	{
+		int hits = 0;
+		Triangle::kernel = kernels[k];
+
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		for( int i = 0; i < tests; i++ )
+		{
+			HitGeom hitgeom;
+			hitgeom.distance = Infinity;
+			if( triangles[i % triangles.size()]->Intersect( rays[i], hitgeom ) ) hits++;
+		}
+		double seconds = std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - start ).count();
+
+		cout << kernel_names[k] << ": " << tests / seconds / 1.0E6 << " million tests per second, " << hits << " hits." << endl;
+	}
+	Triangle::kernel = kernel;
 }
 
 Camera World::getCamera( void )
@@ -20,7 +20,11 @@ class World
 	public:
 		World() {};
 		virtual ~World() {};
-		bool readScene( const char *filename );
+		bool readScene( const char *filename, const char *accel = NULL, bool use_cache = true );
+		bool updateScene( void );
+		void benchmarkAnimation( int frames );
+		void benchmarkLayouts( int width, int height );
+		void benchmarkTriangles( int tests );
 		Camera getCamera( void );
 		Scene getScene( void );
 };